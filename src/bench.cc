@@ -0,0 +1,347 @@
+#include <tll/channel.h>
+#include <tll/scheme.h>
+#include <tll/scheme/util.h>
+#include <tll/util/listiter.h>
+#include <tll/util/memoryview.h>
+
+#include <fmt/chrono.h>
+#include <fmt/format.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstdlib>
+#include <set>
+#include <string>
+#include <vector>
+
+#include <getopt.h>
+
+#include "odbc-scheme.h"
+
+// Load generator for odbc channel: insert synthetic or recorded messages and read them back,
+// measuring throughput and latency percentiles
+
+using clock_type = std::chrono::steady_clock;
+using duration = std::chrono::duration<int64_t, std::nano>;
+
+namespace {
+
+struct Message
+{
+	int msgid;
+	long long seq;
+	std::vector<char> data;
+};
+
+struct Stat
+{
+	std::vector<duration> samples;
+	duration total = {};
+
+	void add(duration d)
+	{
+		samples.push_back(d);
+		total += d;
+	}
+
+	duration percentile(double p) const
+	{
+		if (samples.empty())
+			return {};
+		return samples[std::min<size_t>(samples.size() - 1, samples.size() * p)];
+	}
+
+	std::string report(std::string_view name)
+	{
+		std::sort(samples.begin(), samples.end());
+		double rate = 0;
+		if (total.count())
+			rate = samples.size() / std::chrono::duration<double>(total).count();
+		return fmt::format("{} {:.0f} rows/s, p50 {}, p99 {}, p999 {}", name, rate, percentile(0.5), percentile(0.99), percentile(0.999));
+	}
+};
+
+struct Fetch
+{
+	size_t rows = 0;
+	bool done = false;
+};
+
+struct Config
+{
+	std::string url = "odbc://;driver=SQLite3;database=odbc-bench.db;quote-mode=sqlite";
+	bool fetch = true;
+};
+
+std::vector<unsigned> parse_list(std::string_view str)
+{
+	std::vector<unsigned> r;
+	while (str.size()) {
+		auto pos = str.find(',');
+		r.push_back(strtoul(std::string(str.substr(0, pos)).c_str(), nullptr, 0));
+		if (pos == str.npos)
+			break;
+		str = str.substr(pos + 1);
+	}
+	return r;
+}
+
+int on_fetch(const tll_channel_t *, const tll_msg_t *msg, void * user)
+{
+	auto fetch = static_cast<Fetch *>(user);
+	if (msg->type == TLL_MESSAGE_DATA)
+		fetch->rows++;
+	else if (msg->type == TLL_MESSAGE_CONTROL && msg->msgid == odbc_scheme::EndOfData::meta_id())
+		fetch->done = true;
+	return 0;
+}
+
+int on_replay(const tll_channel_t *, const tll_msg_t *msg, void * user)
+{
+	auto list = static_cast<std::vector<Message> *>(user);
+	auto data = static_cast<const char *>(msg->data);
+	list->push_back({msg->msgid, msg->seq, std::vector<char>(data, data + msg->size)});
+	return 0;
+}
+
+std::unique_ptr<tll::Channel> channel(tll::channel::Context &ctx, std::string_view str, std::string_view scheme)
+{
+	auto url = tll::Channel::Url::parse(str);
+	if (!url) {
+		fmt::print(stderr, "Invalid url '{}': {}\n", str, url.error());
+		return nullptr;
+	}
+	if (scheme.size())
+		url->set("scheme", scheme);
+	return ctx.channel(*url);
+}
+
+std::string synthetic_table(unsigned width, unsigned strlen) { return fmt::format("bench_w{}_s{}", width, strlen); }
+
+std::string synthetic_scheme(unsigned width, unsigned strlen)
+{
+	auto r = fmt::format("yamls://\n- name: Data\n  id: 10\n  options.sql.table: {}\n  fields:\n", synthetic_table(width, strlen));
+	for (auto i = 0u; i < width; i++)
+		r += fmt::format("    - {{name: f{}, type: int64}}\n", i);
+	if (strlen)
+		r += "    - {name: s0, type: string}\n";
+	return r;
+}
+
+std::vector<Message> synthetic_data(const tll::scheme::Message * message, unsigned rows, unsigned strlen)
+{
+	std::vector<Message> r;
+	r.reserve(rows);
+	for (auto i = 0u; i < rows; i++) {
+		auto & m = r.emplace_back(Message { message->msgid, i, {} });
+		m.data.resize(message->size + (strlen ? strlen + 1 : 0));
+		auto view = tll::make_view(m.data);
+		for (auto & f : tll::util::list_wrap(message->fields)) {
+			if (f.type == tll::scheme::Field::Int64) {
+				*view.view(f.offset).dataT<int64_t>() = i * 1000 + f.offset;
+			} else if (f.type == tll::scheme::Field::Pointer) {
+				tll::scheme::generic_offset_ptr_t ptr = {};
+				ptr.offset = message->size - f.offset;
+				ptr.size = strlen + 1;
+				ptr.entity = 1;
+				tll::scheme::write_pointer(&f, view.view(f.offset), ptr);
+				memset(view.view(message->size).data(), 'a' + i % 26, strlen);
+			}
+		}
+	}
+	return r;
+}
+
+// Drop table before run, statement is executed on connect and channel does not prepare anything
+int drop_table(tll::channel::Context &ctx, const Config &cfg, std::string_view table)
+{
+	auto c = channel(ctx, fmt::format("{};name=drop;default-template=none;init-sql.0=DROP TABLE IF EXISTS {}", cfg.url, table), "yamls://[]");
+	if (!c || c->open()) {
+		fmt::print(stderr, "Failed to drop table {}\n", table);
+		return EINVAL;
+	}
+	c->close();
+	return 0;
+}
+
+int run(tll::channel::Context &ctx, const Config &cfg, std::string_view scheme, const std::vector<Message> &data, std::string_view name)
+{
+	auto c = channel(ctx, fmt::format("{};name=odbc;create-mode=checked", cfg.url), scheme);
+	if (!c || c->open()) {
+		fmt::print(stderr, "Failed to open odbc channel\n");
+		return EINVAL;
+	}
+
+	Stat post;
+	post.samples.reserve(data.size());
+	std::set<int> messages;
+	for (auto & m : data) {
+		tll_msg_t msg = { TLL_MESSAGE_DATA };
+		msg.msgid = m.msgid;
+		msg.seq = m.seq;
+		msg.data = m.data.data();
+		msg.size = m.data.size();
+		messages.insert(m.msgid);
+
+		auto start = clock_type::now();
+		if (auto r = c->post(&msg); r) {
+			fmt::print(stderr, "Failed to post message {}, seq {}: {}\n", m.msgid, m.seq, r);
+			return r;
+		}
+		post.add(std::chrono::duration_cast<duration>(clock_type::now() - start));
+	}
+
+	std::string fetch = "fetch skipped";
+	if (cfg.fetch) {
+		Fetch state;
+		c->callback_add(on_fetch, &state, TLL_MESSAGE_MASK_DATA | TLL_MESSAGE_MASK_CONTROL);
+
+		Stat rows;
+		rows.samples.reserve(data.size());
+		for (auto id : messages) {
+			std::vector<char> buf(odbc_scheme::Query::meta_size());
+			odbc_scheme::Query::bind(buf).set_message(id);
+			tll_msg_t msg = { TLL_MESSAGE_CONTROL };
+			msg.msgid = odbc_scheme::Query::meta_id();
+			msg.data = buf.data();
+			msg.size = buf.size();
+
+			state.done = false;
+			auto start = clock_type::now();
+			if (auto r = c->post(&msg); r) {
+				fmt::print(stderr, "Failed to post query for message {}: {}\n", id, r);
+				return r;
+			}
+			// Latency of each row includes query execution for the first one
+			while (!state.done && c->state() == TLL_STATE_ACTIVE) {
+				auto count = state.rows;
+				c->process();
+				if (state.rows == count)
+					continue;
+				auto now = clock_type::now();
+				rows.add(std::chrono::duration_cast<duration>(now - start));
+				start = now;
+			}
+		}
+		c->callback_del(on_fetch, &state, TLL_MESSAGE_MASK_DATA | TLL_MESSAGE_MASK_CONTROL);
+		fetch = rows.report("fetch");
+	}
+
+	fmt::print("{}: {}; {}\n", name, post.report("insert"), fetch);
+	c->close();
+	return 0;
+}
+
+int replay(tll::channel::Context &ctx, const Config &cfg, std::string_view filename)
+{
+	std::vector<Message> data;
+	auto file = channel(ctx, fmt::format("file://{};name=replay;dir=r;autoclose=no", filename), "");
+	if (!file || file->open()) {
+		fmt::print(stderr, "Failed to open file {}\n", filename);
+		return EINVAL;
+	}
+	file->callback_add(on_replay, &data, TLL_MESSAGE_MASK_DATA);
+	while (file->state() == TLL_STATE_ACTIVE) {
+		auto r = file->process();
+		if (r == EAGAIN) // End of file
+			break;
+		if (r) {
+			fmt::print(stderr, "Failed to read file {}\n", filename);
+			return r;
+		}
+	}
+
+	auto scheme = file->scheme();
+	if (!scheme) {
+		fmt::print(stderr, "File {} has no scheme\n", filename);
+		return EINVAL;
+	}
+	std::unique_ptr<char, decltype(&free)> str(tll_scheme_dump(scheme, "yamls+gz"), &free);
+	if (!str) {
+		fmt::print(stderr, "Failed to dump scheme of {}\n", filename);
+		return EINVAL;
+	}
+	return run(ctx, cfg, str.get(), data, fmt::format("replay {} rows={}", filename, data.size()));
+}
+
+int sweep(tll::channel::Context &ctx, const Config &cfg, const std::vector<unsigned> &widths, const std::vector<unsigned> &strings, const std::vector<unsigned> &counts)
+{
+	for (auto width : widths) {
+		for (auto strlen : strings) {
+			auto scheme = synthetic_scheme(width, strlen);
+			auto s = ctx.scheme_load(scheme);
+			if (!s) {
+				fmt::print(stderr, "Failed to load scheme:\n{}\n", scheme);
+				return EINVAL;
+			}
+			auto data = synthetic_data(s->lookup("Data"), *std::max_element(counts.begin(), counts.end()), strlen);
+			tll_scheme_unref(s);
+
+			for (auto rows : counts) {
+				if (auto r = drop_table(ctx, cfg, synthetic_table(width, strlen)); r)
+					return r;
+				std::vector<Message> slice(data.begin(), data.begin() + rows);
+				if (auto r = run(ctx, cfg, scheme, slice, fmt::format("width={} strlen={} rows={}", width, strlen, rows)); r)
+					return r;
+			}
+		}
+	}
+	return 0;
+}
+
+void usage(const char * name)
+{
+	fmt::print("Usage: {} [options]\n"
+		"  -u URL       ODBC channel url without scheme\n"
+		"  -m MODULE    Path to tll-odbc module (default: tll-odbc)\n"
+		"  -w LIST      Comma separated list of message widths (number of int64 fields)\n"
+		"  -s LIST      Comma separated list of string field lengths, 0 for no string field\n"
+		"  -n LIST      Comma separated list of row counts\n"
+		"  -r FILE      Replay messages from tll data file instead of synthetic ones\n"
+		"  -F           Skip fetch stage\n", name);
+}
+}
+
+int main(int argc, char *argv[])
+{
+	Config cfg;
+	std::string module = "tll-odbc";
+	std::string filename;
+	std::vector<unsigned> widths = {1, 8, 32};
+	std::vector<unsigned> strings = {0, 16, 256};
+	std::vector<unsigned> counts = {10000};
+
+	for (int opt; (opt = getopt(argc, argv, "hu:m:w:s:n:r:F")) != -1; ) {
+		switch (opt) {
+		case 'u': cfg.url = optarg; break;
+		case 'm': module = optarg; break;
+		case 'w': widths = parse_list(optarg); break;
+		case 's': strings = parse_list(optarg); break;
+		case 'n': counts = parse_list(optarg); break;
+		case 'r': filename = optarg; break;
+		case 'F': cfg.fetch = false; break;
+		case 'h': usage(argv[0]); return 0;
+		default: usage(argv[0]); return 1;
+		}
+	}
+
+	if (widths.empty() || strings.empty() || counts.empty()) {
+		usage(argv[0]);
+		return 1;
+	}
+
+	auto ctx = tll::channel::Context::init();
+	if (!ctx) {
+		fmt::print(stderr, "Failed to create context\n");
+		return 1;
+	}
+	if (ctx->load(module)) {
+		fmt::print(stderr, "Failed to load module {}\n", module);
+		return 1;
+	}
+
+	if (filename.size())
+		return replay(*ctx, cfg, filename) ? 1 : 0;
+	return sweep(*ctx, cfg, widths, strings, counts) ? 1 : 0;
+}
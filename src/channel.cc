@@ -4,16 +4,28 @@
 #include <tll/scheme/util.h>
 #include <tll/util/listiter.h>
 #include <tll/util/memoryview.h>
+#include <tll/util/size.h>
 #include <tll/util/decimal128.h>
 
+#include <algorithm>
+#include <atomic>
 #include <chrono>
+#include <condition_variable>
+#include <cstdlib>
+#include <limits>
+#include <list>
+#include <mutex>
+#include <set>
+#include <thread>
 
 #include <sql.h>
 #include <sqlext.h>
 #include <time.h>
 
 #include "heartbeat.h"
+#include "journal.h"
 #include "odbc-scheme.h"
+#include "probes.h"
 
 using Channel = tll::Channel;
 namespace dcaps { using namespace tll::dcaps; }
@@ -55,18 +67,39 @@ struct SQLHandle
 
 using query_ptr_t = SQLHandle<SQL_HANDLE_STMT>;
 
+// Process wide environment and connections shared between channels with shared-connection option
+struct Registry
+{
+	struct Connection {
+		std::weak_ptr<SQLHandle<SQL_HANDLE_DBC>::HandleType> db;
+		std::shared_ptr<std::atomic<bool>> lost; // Set by user that got fatal error, others fail on next call
+	};
+
+	std::mutex lock;
+	std::weak_ptr<SQLHandle<SQL_HANDLE_ENV>::HandleType> env;
+	std::map<std::string, Connection, std::less<>> connections;
+
+	static Registry & instance()
+	{
+		static Registry registry;
+		return registry;
+	}
+};
+
 struct Prepared
 {
 	Prepared(query_ptr_t && ptr) : sql(std::move(ptr)) {}
 	query_ptr_t sql;
+	std::string query; // SQL text for diagnostics
 	const tll::scheme::Message * message = nullptr;
 	const tll::scheme::Message * output_message = nullptr;
 	Prepared * output = nullptr; // Non-null for function calls
 
 	struct Convert {
-		enum Type { None, String, Numeric, Timestamp } type = None;
+		enum Type { None, String, Numeric, Timestamp, Scaled } type = None;
 		const tll::scheme::Field * field;
 		SQLLEN param;
+		int scale = 0; // Digits after point for decimal stored as integer
 		union {
 			int64_t integer;
 			struct {
@@ -80,6 +113,221 @@ struct Prepared
 	};
 	std::vector<Convert> convert;
 	bool with_seq;
+	bool cache = false; // Query results are cached
+
+	enum class Storage { Columns, Blob } storage = Storage::Columns;
+	std::string table;
+	SQLLEN data_param = 0;
+
+	const tll::scheme::Field * rows = nullptr; // List of rows for multi-row insert
+
+	// Message that holds columns: row message for multi-row insert
+	const tll::scheme::Message * row_message() const
+	{
+		if (!rows)
+			return message;
+		if (rows->type == tll::scheme::Field::Array)
+			return rows->type_array->type_msg;
+		return rows->type_ptr->type_msg;
+	}
+
+	struct Partition {
+		enum Mode { None, Daily, Hourly } mode = None;
+		const tll::scheme::Field * field = nullptr; // Time field, wall clock is used if not set
+		std::string insert; // Columns and values part of INSERT statement
+		std::string query; // Full text of active statement for slow statement log
+		bool create = false;
+		long active = -1; // Period of current statement
+		long last = -1; // Latest seen period
+		std::map<long, query_ptr_t> tables;
+
+		long step() const { return mode == Daily ? 86400 : 3600; }
+		long period(time_t seconds) const { return seconds / step(); }
+	} partition;
+
+	// Text of statement that is executed on insert, partitioned table uses active partition
+	std::string_view statement() const { return partition.active >= 0 ? partition.query : query; }
+
+	struct Retention {
+		enum Mode { None, Count, Age } mode = None;
+		long long count = 0; // Number of latest seq values that are kept
+		tll::duration age = {};
+		Convert convert; // Time field for age mode
+		std::vector<char> value; // Cutoff time in field representation
+		query_ptr_t sql;
+	} retention;
+};
+
+// Copy of expression value, can outlive control message
+struct Parameter
+{
+	SQLSMALLINT ctype = SQL_C_SBIGINT;
+	SQLSMALLINT sqltype = SQL_BIGINT;
+	int64_t integer = 0;
+	double real = 0;
+	std::string string;
+	SQLLEN param = 0;
+
+	Parameter() = default;
+
+	template <typename Value>
+	explicit Parameter(const Value &value)
+	{
+		switch (value.union_type()) {
+		case Value::index_i:
+			integer = value.unchecked_i();
+			break;
+		case Value::index_f:
+			ctype = SQL_C_DOUBLE;
+			sqltype = SQL_DOUBLE;
+			real = value.unchecked_f();
+			break;
+		case Value::index_s:
+			ctype = SQL_C_CHAR;
+			sqltype = SQL_VARCHAR;
+			string = value.unchecked_s();
+			break;
+		}
+	}
+
+	SQLPOINTER data()
+	{
+		switch (ctype) {
+		case SQL_C_DOUBLE: return &real;
+		case SQL_C_CHAR: return string.data();
+		}
+		return &integer;
+	}
+};
+
+// Select statement executed in separate thread, rows are converted into messages and passed in blocks
+struct Fetcher
+{
+	struct Record {
+		long long seq;
+		size_t size;
+	};
+
+	// Sequence of records, each followed by message body and aligned to 8 bytes
+	struct Block {
+		std::vector<char> data;
+		size_t offset = 0; // Read position
+		size_t count = 0;
+
+		static size_t record_size(size_t size) { return (sizeof(Record) + size + 7) & ~size_t(7); }
+
+		bool empty() const { return offset == data.size(); }
+
+		void push_back(long long seq, const void * body, size_t size)
+		{
+			auto off = data.size();
+			data.resize(off + record_size(size));
+			auto r = reinterpret_cast<Record *>(data.data() + off);
+			r->seq = seq;
+			r->size = size;
+			memcpy(r + 1, body, size);
+			count++;
+		}
+
+		void clear() { data.clear(); offset = count = 0; }
+	};
+
+	Fetcher() : select(query_ptr_t {}) {}
+	~Fetcher()
+	{
+		stop();
+		select.sql.reset();
+	}
+
+	SQLHandle<SQL_HANDLE_DBC> db; // Connection taken from channel pool, empty when prefetch connection is used
+	Prepared select; // Statement with own column buffers
+	std::vector<Parameter> params;
+	std::vector<char> buf;
+	long long seq = 0;
+	SQLLEN seq_param = 0;
+
+	std::thread thread;
+	std::mutex lock;
+	std::condition_variable cond;
+	std::list<Block> ready;
+	std::list<Block> spare;
+	size_t depth = 2; // Limit of ready blocks
+	bool stopped = false;
+	bool finished = false;
+	SQLRETURN result = SQL_SUCCESS;
+	std::string_view stage;
+
+	// Fetch thread side: wait until there is free slot in queue, false if fetcher is stopped
+	bool push(Block &block)
+	{
+		std::unique_lock<std::mutex> guard(lock);
+		cond.wait(guard, [&]() { return stopped || ready.size() < depth; });
+		if (stopped)
+			return false;
+		ready.push_back(std::move(block));
+		if (spare.size()) {
+			block = std::move(spare.front());
+			spare.pop_front();
+		} else
+			block = {};
+		cond.notify_all();
+		return true;
+	}
+
+	void finish(SQLRETURN r, std::string_view s)
+	{
+		std::unique_lock<std::mutex> guard(lock);
+		result = r;
+		stage = s;
+		finished = true;
+		cond.notify_all();
+	}
+
+	// Processing side: replace consumed block with next one from queue, EAGAIN if it is not ready yet
+	// and ENOENT if fetch is finished. Never blocks, channel is polled with Pending dcap
+	int pop(Block &block)
+	{
+		std::unique_lock<std::mutex> guard(lock);
+		if (ready.empty())
+			return finished ? ENOENT : EAGAIN;
+		block.clear();
+		spare.push_back(std::move(block));
+		block = std::move(ready.front());
+		ready.pop_front();
+		cond.notify_all();
+		return 0;
+	}
+
+	void stop()
+	{
+		bool running = false;
+		{
+			std::unique_lock<std::mutex> guard(lock);
+			stopped = true;
+			running = !finished;
+			cond.notify_all();
+		}
+		if (!thread.joinable())
+			return;
+		if (running)
+			SQLCancel(select.sql);
+		thread.join();
+	}
+};
+
+// Cursor of merged query, rows are read in blocks from processing thread
+struct MergeCursor
+{
+	MergeCursor() : select(query_ptr_t {}) {}
+
+	SQLHandle<SQL_HANDLE_DBC> db; // Pooled connection, released after statement
+	Prepared select;
+	std::vector<char> buf;
+	long long seq = 0;
+	SQLLEN seq_param = 0;
+	Fetcher::Block block;
+
+	const Fetcher::Record * front() const { return reinterpret_cast<const Fetcher::Record *>(block.data.data() + block.offset); }
 };
 
 namespace {
@@ -103,9 +351,84 @@ std::string join(const Iter &begin, const Iter &end)
 	return join(", ", begin, end);
 }
 
+std::vector<std::string_view> split(std::string_view str, char sep)
+{
+	std::vector<std::string_view> r;
+	while (str.size()) {
+		auto pos = str.find(sep);
+		auto item = str.substr(0, pos);
+		if (item.size())
+			r.push_back(item);
+		if (pos == str.npos)
+			break;
+		str = str.substr(pos + 1);
+	}
+	return r;
+}
+
+enum class FieldStorage { Default, Integer };
+
+// Column storage from sql.storage field option, integer is valid only for time points and decimals
+tll::result_t<FieldStorage> field_storage(const tll::scheme::Field *field)
+{
+	using tll::scheme::Field;
+	auto r = tll::getter::getT(field->options, "sql.storage", FieldStorage::Default, {{"default", FieldStorage::Default}, {"integer", FieldStorage::Integer}});
+	if (!r)
+		return tll::error(r.error());
+	if (*r == FieldStorage::Integer) {
+		if (field->type == Field::Double)
+			return tll::error("integer storage can not be used for floating point time");
+		if (field->sub_type != Field::TimePoint && field->type != Field::Decimal128)
+			return tll::error("integer storage can be used only for time points and decimals");
+	}
+	return *r;
+}
+
+bool integer_storage(const tll::scheme::Field *field)
+{
+	auto r = field_storage(field);
+	return r && *r == FieldStorage::Integer;
+}
+
+// Decimal with fixed number of digits after point as integer, fails if value can not be represented exactly
+int decimal_to_scaled(const tll::util::Decimal128 &value, int scale, int64_t &result)
+{
+	tll::util::Decimal128::Unpacked u128;
+	value.unpack(u128);
+	unsigned __int128 m;
+	static_assert(sizeof(m) == sizeof(u128.mantissa));
+	memcpy(&m, &u128.mantissa, sizeof(m));
+	for (auto e = u128.exponent + scale; e > 0; e--) {
+		if (m > std::numeric_limits<uint64_t>::max())
+			return ERANGE;
+		m *= 10;
+	}
+	for (auto e = u128.exponent + scale; e < 0; e++) {
+		if (m % 10)
+			return ERANGE;
+		m /= 10;
+	}
+	if (m > (unsigned __int128) std::numeric_limits<int64_t>::max())
+		return ERANGE;
+	result = u128.sign ? -(int64_t) m : (int64_t) m;
+	return 0;
+}
+
+void decimal_from_scaled(int64_t value, int scale, tll::util::Decimal128 &result)
+{
+	tll::util::Decimal128::Unpacked u128;
+	unsigned __int128 m = value < 0 ? (unsigned __int128) (-(value + 1)) + 1 : value;
+	memcpy(&u128.mantissa, &m, sizeof(m));
+	u128.sign = value < 0;
+	u128.exponent = -scale;
+	result.pack(u128);
+}
+
 tll::result_t<std::string> sql_type(const tll::scheme::Field *field)
 {
 	using tll::scheme::Field;
+	if (integer_storage(field))
+		return "BIGINT";
 	switch (field->sub_type) {
 	case Field::TimePoint:
 		return "TIMESTAMP";
@@ -151,6 +474,99 @@ tll::result_t<std::string> sql_type(const tll::scheme::Field *field)
 	return tll::error("Invalid field type");
 }
 
+enum class TypeClass { Unknown, Integer, Float, Numeric, String, Timestamp, Binary };
+
+TypeClass type_class(SQLSMALLINT type)
+{
+	switch (type) {
+	case SQL_TINYINT:
+	case SQL_SMALLINT:
+	case SQL_INTEGER:
+	case SQL_BIGINT:
+		return TypeClass::Integer;
+	case SQL_REAL:
+	case SQL_FLOAT:
+	case SQL_DOUBLE:
+		return TypeClass::Float;
+	case SQL_NUMERIC:
+	case SQL_DECIMAL:
+		return TypeClass::Numeric;
+	case SQL_CHAR:
+	case SQL_VARCHAR:
+	case SQL_LONGVARCHAR:
+	case SQL_WCHAR:
+	case SQL_WVARCHAR:
+	case SQL_WLONGVARCHAR:
+		return TypeClass::String;
+	case SQL_TYPE_DATE:
+	case SQL_TYPE_TIMESTAMP:
+	case SQL_DATE:
+	case SQL_TIMESTAMP:
+		return TypeClass::Timestamp;
+	case SQL_BINARY:
+	case SQL_VARBINARY:
+	case SQL_LONGVARBINARY:
+		return TypeClass::Binary;
+	default:
+		break;
+	}
+	return TypeClass::Unknown;
+}
+
+TypeClass type_class(const tll::scheme::Field *field)
+{
+	using tll::scheme::Field;
+	if (integer_storage(field))
+		return TypeClass::Integer;
+	if (field->sub_type == Field::TimePoint)
+		return TypeClass::Timestamp;
+	switch (field->type) {
+	case Field::Int8:
+	case Field::UInt8:
+	case Field::Int16:
+	case Field::UInt16:
+	case Field::Int32:
+	case Field::UInt32:
+	case Field::Int64:
+	case Field::UInt64:
+		return TypeClass::Integer;
+	case Field::Double:
+		return TypeClass::Float;
+	case Field::Decimal128:
+		return TypeClass::Numeric;
+	case Field::Bytes:
+	case Field::Pointer:
+		return TypeClass::String;
+	default:
+		break;
+	}
+	return TypeClass::Unknown;
+}
+
+std::string_view type_class_name(TypeClass t)
+{
+	switch (t) {
+	case TypeClass::Unknown: return "unknown";
+	case TypeClass::Integer: return "integer";
+	case TypeClass::Float: return "float";
+	case TypeClass::Numeric: return "numeric";
+	case TypeClass::String: return "string";
+	case TypeClass::Timestamp: return "timestamp";
+	case TypeClass::Binary: return "binary";
+	}
+	return "unknown";
+}
+
+bool type_compatible(TypeClass expected, TypeClass actual)
+{
+	if (expected == actual || expected == TypeClass::Unknown || actual == TypeClass::Unknown)
+		return true;
+	// Some drivers report numeric affinity for any number
+	if (actual == TypeClass::Numeric)
+		return expected == TypeClass::Integer || expected == TypeClass::Float;
+	return false;
+}
+
 template <typename T, typename Res>
 std::pair<time_t, unsigned> split_time(const T * data)
 {
@@ -170,6 +586,72 @@ T compose_time(time_t seconds, unsigned ns)
 	return ts.count();
 }
 
+template <typename T>
+time_t time_seconds(const tll::scheme::Field * field, const T * data)
+{
+	switch (field->time_resolution) {
+	case TLL_SCHEME_TIME_NS: return split_time<T, std::nano>(data).first;
+	case TLL_SCHEME_TIME_US: return split_time<T, std::micro>(data).first;
+	case TLL_SCHEME_TIME_MS: return split_time<T, std::milli>(data).first;
+	case TLL_SCHEME_TIME_SECOND: return split_time<T, std::ratio<1>>(data).first;
+	case TLL_SCHEME_TIME_MINUTE: return split_time<T, std::ratio<60>>(data).first;
+	case TLL_SCHEME_TIME_HOUR: return split_time<T, std::ratio<3600>>(data).first;
+	case TLL_SCHEME_TIME_DAY: return split_time<T, std::ratio<86400>>(data).first;
+	}
+	return 0;
+}
+
+time_t time_seconds(const tll::scheme::Field * field, const void * data)
+{
+	using tll::scheme::Field;
+	switch (field->type) {
+	case Field::Int8: return time_seconds(field, static_cast<const int8_t *>(data));
+	case Field::Int16: return time_seconds(field, static_cast<const int16_t *>(data));
+	case Field::Int32: return time_seconds(field, static_cast<const int32_t *>(data));
+	case Field::Int64: return time_seconds(field, static_cast<const int64_t *>(data));
+	case Field::UInt8: return time_seconds(field, static_cast<const uint8_t *>(data));
+	case Field::UInt16: return time_seconds(field, static_cast<const uint16_t *>(data));
+	case Field::UInt32: return time_seconds(field, static_cast<const uint32_t *>(data));
+	case Field::UInt64: return time_seconds(field, static_cast<const uint64_t *>(data));
+	case Field::Double: return time_seconds(field, static_cast<const double *>(data));
+	default:
+		break;
+	}
+	return 0;
+}
+
+template <typename T>
+void time_store(const tll::scheme::Field * field, time_t seconds, unsigned ns, T * data)
+{
+	switch (field->time_resolution) {
+	case TLL_SCHEME_TIME_NS: *data = compose_time<T, std::nano>(seconds, ns); break;
+	case TLL_SCHEME_TIME_US: *data = compose_time<T, std::micro>(seconds, ns); break;
+	case TLL_SCHEME_TIME_MS: *data = compose_time<T, std::milli>(seconds, ns); break;
+	case TLL_SCHEME_TIME_SECOND: *data = compose_time<T, std::ratio<1>>(seconds, ns); break;
+	case TLL_SCHEME_TIME_MINUTE: *data = compose_time<T, std::ratio<60>>(seconds, ns); break;
+	case TLL_SCHEME_TIME_HOUR: *data = compose_time<T, std::ratio<3600>>(seconds, ns); break;
+	case TLL_SCHEME_TIME_DAY: *data = compose_time<T, std::ratio<86400>>(seconds, ns); break;
+	}
+}
+
+void time_store(const tll::scheme::Field * field, time_t seconds, unsigned ns, void * data)
+{
+	using tll::scheme::Field;
+	switch (field->type) {
+	case Field::Int8: return time_store(field, seconds, ns, static_cast<int8_t *>(data));
+	case Field::Int16: return time_store(field, seconds, ns, static_cast<int16_t *>(data));
+	case Field::Int32: return time_store(field, seconds, ns, static_cast<int32_t *>(data));
+	case Field::Int64: return time_store(field, seconds, ns, static_cast<int64_t *>(data));
+	case Field::UInt8: return time_store(field, seconds, ns, static_cast<uint8_t *>(data));
+	case Field::UInt16: return time_store(field, seconds, ns, static_cast<uint16_t *>(data));
+	case Field::UInt32: return time_store(field, seconds, ns, static_cast<uint32_t *>(data));
+	case Field::UInt64: return time_store(field, seconds, ns, static_cast<uint64_t *>(data));
+	case Field::Double: return time_store(field, seconds, ns, static_cast<double *>(data));
+	default:
+		break;
+	}
+}
+
 template <typename T, typename Buf>
 int write_time(tll::Logger &_log, const Prepared::Convert & convert, Buf data)
 {
@@ -202,37 +684,179 @@ int write_time(tll::Logger &_log, const Prepared::Convert & convert, Buf data)
 	return 0;
 }
 
+template <typename T>
+int sql_timestamp(const tll::scheme::Field * field, const T * data, SQL_TIMESTAMP_STRUCT &ts)
+{
+	std::pair<time_t, unsigned> parts = {};
+	switch (field->time_resolution) {
+	case TLL_SCHEME_TIME_NS: parts = split_time<T, std::nano>(data); break;
+	case TLL_SCHEME_TIME_US: parts = split_time<T, std::micro>(data); break;
+	case TLL_SCHEME_TIME_MS: parts = split_time<T, std::milli>(data); break;
+	case TLL_SCHEME_TIME_SECOND: parts = split_time<T, std::ratio<1>>(data); break;
+	case TLL_SCHEME_TIME_MINUTE: parts = split_time<T, std::ratio<60>>(data); break;
+	case TLL_SCHEME_TIME_HOUR: parts = split_time<T, std::ratio<3600>>(data); break;
+	case TLL_SCHEME_TIME_DAY: parts = split_time<T, std::ratio<86400>>(data); break;
+	}
+	struct tm result;
+	if (!gmtime_r(&parts.first, &result))
+		return EOVERFLOW;
+	ts.year = 1900 + result.tm_year;
+	ts.month = 1 + result.tm_mon;
+	ts.day = result.tm_mday;
+	ts.hour = result.tm_hour;
+	ts.minute = result.tm_min;
+	ts.second = result.tm_sec;
+	ts.fraction = parts.second;
+	return 0;
+}
+
 template <typename T>
 int sql_bind_numeric(SQLHSTMT sql, int idx, int ctype, int sqltype, const T * data, Prepared::Convert &convert)
 {
-	using tll::scheme::Field;
-	if (convert.field->sub_type == Field::TimePoint) {
-		std::pair<time_t, unsigned> parts = {};
-		switch (convert.field->time_resolution) {
-		case TLL_SCHEME_TIME_NS: parts = split_time<T, std::nano>(data); break;
-		case TLL_SCHEME_TIME_US: parts = split_time<T, std::micro>(data); break;
-		case TLL_SCHEME_TIME_MS: parts = split_time<T, std::milli>(data); break;
-		case TLL_SCHEME_TIME_SECOND: parts = split_time<T, std::ratio<1>>(data); break;
-		case TLL_SCHEME_TIME_MINUTE: parts = split_time<T, std::ratio<60>>(data); break;
-		case TLL_SCHEME_TIME_HOUR: parts = split_time<T, std::ratio<3600>>(data); break;
-		case TLL_SCHEME_TIME_DAY: parts = split_time<T, std::ratio<86400>>(data); break;
-		}
-		struct tm result;
-		if (!gmtime_r(&parts.first, &result))
-			return EOVERFLOW;
-		convert.timestamp.year = 1900 + result.tm_year;
-		convert.timestamp.month = 1 + result.tm_mon;
-		convert.timestamp.day = result.tm_mday;
-		convert.timestamp.hour = result.tm_hour;
-		convert.timestamp.minute = result.tm_min;
-		convert.timestamp.second = result.tm_sec;
-		convert.timestamp.fraction = parts.second;
+	if (convert.type == Prepared::Convert::Timestamp) {
+		if (auto r = sql_timestamp(convert.field, data, convert.timestamp); r)
+			return r;
 		convert.param = sizeof(convert.timestamp);
 		return SQLBindParam(sql, idx, SQL_C_TYPE_TIMESTAMP, SQL_TYPE_TIMESTAMP, 0, 0, (SQLPOINTER) &convert.timestamp, &convert.param);
 	}
 	return SQLBindParam(sql, idx, ctype, sqltype, 0, 0, (SQLPOINTER) data, &convert.param);
 }
 
+// Column of parameter array for multi-row insert, values are copied into row-wise buffer
+struct RowColumn
+{
+	const tll::scheme::Field * field = nullptr; // Null for seq column
+	SQLSMALLINT ctype = SQL_C_SBIGINT;
+	SQLSMALLINT sqltype = SQL_BIGINT;
+	size_t size = sizeof(int64_t); // Size of value slot
+	size_t offset = 0; // Offset of value slot in buffer row
+	size_t indicator = 0; // Offset of SQLLEN indicator in buffer row
+	int scale = 0; // Decimal stored as integer
+};
+
+int row_column(RowColumn &col)
+{
+	using tll::scheme::Field;
+	auto field = col.field;
+	if (integer_storage(field)) {
+		if (field->type == Field::Decimal128) {
+			col.ctype = SQL_C_SBIGINT;
+			col.sqltype = SQL_BIGINT;
+			col.size = sizeof(int64_t);
+			col.scale = tll::getter::getT(field->options, "sql.scale", 0u).value_or(0);
+			return 0;
+		}
+	} else if (field->sub_type == Field::TimePoint) {
+		col.ctype = SQL_C_TYPE_TIMESTAMP;
+		col.sqltype = SQL_TYPE_TIMESTAMP;
+		col.size = sizeof(SQL_TIMESTAMP_STRUCT);
+		return 0;
+	}
+	switch (field->type) {
+	case Field::Int8: col.ctype = SQL_C_STINYINT; col.sqltype = SQL_SMALLINT; break;
+	case Field::Int16: col.ctype = SQL_C_SSHORT; col.sqltype = SQL_INTEGER; break;
+	case Field::Int32: col.ctype = SQL_C_SLONG; col.sqltype = SQL_INTEGER; break;
+	case Field::Int64: col.ctype = SQL_C_SBIGINT; col.sqltype = SQL_BIGINT; break;
+	case Field::UInt8: col.ctype = SQL_C_UTINYINT; col.sqltype = SQL_SMALLINT; break;
+	case Field::UInt16: col.ctype = SQL_C_USHORT; col.sqltype = SQL_INTEGER; break;
+	case Field::UInt32: col.ctype = SQL_C_ULONG; col.sqltype = SQL_BIGINT; break;
+	case Field::Double: col.ctype = SQL_C_DOUBLE; col.sqltype = SQL_DOUBLE; break;
+	case Field::Decimal128:
+		// Per-row scale can not be set for parameter array, decimal is passed as text
+		col.ctype = SQL_C_CHAR;
+		col.sqltype = SQL_VARCHAR;
+		col.size = 64;
+		return 0;
+	case Field::Bytes:
+		if (field->sub_type != Field::ByteString)
+			return EINVAL;
+		col.ctype = SQL_C_CHAR;
+		col.sqltype = SQL_VARCHAR;
+		col.size = field->size + 1;
+		return 0;
+	case Field::Pointer:
+		if (field->type_ptr->type != Field::Int8 || field->sub_type != Field::ByteString)
+			return EINVAL;
+		col.ctype = SQL_C_CHAR;
+		col.sqltype = SQL_VARCHAR;
+		col.size = 1; // Updated for each list, see ODBC::_insert_rows
+		return 0;
+	default:
+		return EINVAL;
+	}
+	col.size = field->size;
+	return 0;
+}
+
+template <typename View>
+int row_timestamp(const tll::scheme::Field * field, const View &data, SQL_TIMESTAMP_STRUCT &ts)
+{
+	using tll::scheme::Field;
+	switch (field->type) {
+	case Field::Int8: return sql_timestamp(field, data.template dataT<int8_t>(), ts);
+	case Field::Int16: return sql_timestamp(field, data.template dataT<int16_t>(), ts);
+	case Field::Int32: return sql_timestamp(field, data.template dataT<int32_t>(), ts);
+	case Field::Int64: return sql_timestamp(field, data.template dataT<int64_t>(), ts);
+	case Field::UInt8: return sql_timestamp(field, data.template dataT<uint8_t>(), ts);
+	case Field::UInt16: return sql_timestamp(field, data.template dataT<uint16_t>(), ts);
+	case Field::UInt32: return sql_timestamp(field, data.template dataT<uint32_t>(), ts);
+	case Field::UInt64: return sql_timestamp(field, data.template dataT<uint64_t>(), ts);
+	case Field::Double: return sql_timestamp(field, data.template dataT<double>(), ts);
+	default:
+		break;
+	}
+	return EINVAL;
+}
+
+// Copy field value into parameter array slot
+template <typename View>
+int row_value(const RowColumn &col, const View &data, char * slot, SQLLEN &indicator)
+{
+	using tll::scheme::Field;
+	auto field = col.field;
+	if (col.ctype == SQL_C_TYPE_TIMESTAMP) {
+		indicator = sizeof(SQL_TIMESTAMP_STRUCT);
+		return row_timestamp(field, data, *reinterpret_cast<SQL_TIMESTAMP_STRUCT *>(slot));
+	}
+
+	std::string_view str;
+	std::string decimal;
+	switch (field->type) {
+	case Field::Decimal128:
+		if (col.ctype == SQL_C_SBIGINT) {
+			indicator = 0;
+			return decimal_to_scaled(*data.template dataT<tll::util::Decimal128>(), col.scale, *reinterpret_cast<int64_t *>(slot));
+		}
+		decimal = tll::conv::to_string(*data.template dataT<tll::util::Decimal128>());
+		str = decimal;
+		break;
+	case Field::Bytes: {
+		auto ptr = data.template dataT<char>();
+		str = std::string_view(ptr, strnlen(ptr, field->size));
+		break;
+	}
+	case Field::Pointer: {
+		auto ptr = tll::scheme::read_pointer(field, data);
+		if (!ptr)
+			return EINVAL;
+		if (ptr->size)
+			str = std::string_view(data.view(ptr->offset).template dataT<char>(), ptr->size - 1);
+		break;
+	}
+	default:
+		memcpy(slot, data.data(), col.size);
+		indicator = 0;
+		return 0;
+	}
+
+	if (str.size() >= col.size)
+		return EMSGSIZE;
+	memcpy(slot, str.data(), str.size());
+	slot[str.size()] = '\0';
+	indicator = str.size();
+	return 0;
+}
+
 template <typename Buf>
 int sql_bind(SQLHSTMT sql, Prepared::Convert &convert, int idx, const Buf &data)
 {
@@ -260,6 +884,14 @@ int sql_bind(SQLHSTMT sql, Prepared::Convert &convert, int idx, const Buf &data)
 		return SQL_ERROR;
 
 	case Field::Decimal128: {
+		if (convert.type == Prepared::Convert::Scaled) {
+			if (convert.param != SQL_NULL_DATA) {
+				if (decimal_to_scaled(*data.template dataT<tll::util::Decimal128>(), convert.scale, convert.integer))
+					return SQL_ERROR;
+				convert.param = 0;
+			}
+			return SQLBindParam(sql, idx, SQL_C_SBIGINT, SQL_BIGINT, 0, 0, &convert.integer, &convert.param);
+		}
 		if (convert.param == SQL_NULL_DATA)
 			return SQLBindParam(sql, idx, SQL_C_NUMERIC, SQL_NUMERIC, 0, 0, &convert.numeric, &convert.param);
 		auto & n = convert.numeric;
@@ -328,6 +960,8 @@ int sql_column(SQLHSTMT sql, Prepared::Convert &convert, int idx, const tll::sch
 		return SQLBindCol(sql, idx, SQL_C_NUMERIC, (SQLPOINTER) &convert.numeric, sizeof(SQL_NUMERIC_STRUCT), &convert.param);
 	case Prepared::Convert::Timestamp:
 		return SQLBindCol(sql, idx, SQL_C_TYPE_TIMESTAMP, (SQLPOINTER) &convert.timestamp, sizeof(convert.timestamp), &convert.param);
+	case Prepared::Convert::Scaled:
+		return SQLBindCol(sql, idx, SQL_C_SBIGINT, (SQLPOINTER) &convert.integer, sizeof(convert.integer), &convert.param);
 	case Prepared::Convert::String:
 		return SQLBindCol(sql, idx, SQL_C_CHAR, convert.string, convert.string_size, &convert.param);
 	}
@@ -384,13 +1018,21 @@ class ODBC : public tll::channel::Base<ODBC>
 	query_ptr_t _select_sql;
 	Prepared * _select = nullptr;
 
+	query_ptr_t _ping_sql;
+	std::string _ping_query;
+
 	std::string _settings;
 	std::vector<char> _buf;
-	std::list<std::vector<char>> _string_buffers;
+	std::vector<char> _rows_buf;
+	std::vector<SQLUSMALLINT> _rows_status; // Per-row result of parameter array execute
+	std::map<std::string, std::pair<long long, long long>, std::less<>> _rows_seq; // Seq range of last multi-row insert into table
 	std::vector<char> _errorbuf;
 	std::string_view _sqlstate;
 
 	std::map<int, Prepared> _messages;
+	std::map<std::string, query_ptr_t, std::less<>> _statements; // Prepared select statements
+	size_t _statement_cache = 64;
+	size_t _max_params = 2000; // Drivers limit number of statement parameters, MSSQL allows 2100
 
 	SQLLEN _seq_param;
 	tll_msg_t _msg = {};
@@ -401,8 +1043,120 @@ class ODBC : public tll::channel::Base<ODBC>
 	enum class Create { No, Checked, Always } _create_mode = Create::Checked;
 	enum class Quotes { SQLite, PSQL, Sybase, None } _quotes = Quotes::PSQL;
 	enum class Function { Fields, Empty } _function_mode = Function::Fields;
+	enum class IndexMode { Immediate, Deferred } _index_mode = IndexMode::Immediate;
+	enum class PrepareMode { Eager, Lazy } _prepare_mode = PrepareMode::Eager;
+	enum class Profile { None, Durable, Fast, Bulk } _profile = Profile::None;
+	std::vector<std::string> _init_sql; // Executed on each new connection
+	std::string _prepare_list;
+
+	struct DeferredIndex {
+		std::string table;
+		std::string key;
+		bool unique;
+	};
+	std::vector<DeferredIndex> _deferred_index;
+
+	struct CatalogTable {
+		std::map<std::string, SQLSMALLINT, std::less<>> columns; // Column name -> SQL data type
+		std::set<std::string, std::less<>> indexes;
+		bool indexes_loaded = false;
+		std::string schema;
+	};
+	std::map<std::string, CatalogTable, std::less<>> _catalog; // Keyed by schema qualified name if driver reports schemas
+	std::string _catalog_schema; // Current schema for unqualified table names
 
 	bool _strict = true;
+	unsigned _string_size = 1024;
+
+	std::string _spill_file;
+	tll::duration _spill_latency = {};
+	size_t _spill_size = 0;
+	Journal _journal;
+	bool _spill_active = false;
+
+	bool _spool = false; // Drain select cursor into local file and replay from it
+	std::string _spool_file;
+	unsigned _spool_generation = 0; // Incremented on each fill
+	bool _spool_temp = false; // File is created on open and removed on close
+	size_t _spool_size = 0;
+	size_t _spool_mapped = 0;
+	Journal _spool_journal;
+	bool _spool_active = false;
+
+	std::unique_ptr<tll::Channel> _retention_timer;
+	std::unique_ptr<tll::Channel> _partition_timer;
+	tll::duration _partition_interval = {};
+	tll::duration _retention_interval = {};
+	unsigned _retention_chunk = 1000;
+
+	tll::duration _query_timeout = {};
+
+	bool _commit_ack = false;
+	bool _shared = false; // Environment and connection are taken from process wide registry
+	std::shared_ptr<std::atomic<bool>> _shared_lost;
+	bool _transaction = false;
+	long long _committed_seq = -1; // Highest acknowledged seq
+	long long _pending_seq = -1; // Highest seq written in current transaction
+
+	unsigned _parallel = 1;
+	enum class FetchOrder { Seq, None } _fetch_order = FetchOrder::Seq;
+	size_t _fetch_block = 1024;
+	size_t _fetch_depth = 2;
+	size_t _parallel_depth = 16; // Ranges after head one are buffered while it is emitted
+	bool _prefetch = false;
+
+	struct SlowStatement {
+		tll::time_point time;
+		tll::duration elapsed;
+		std::string_view stage;
+		std::string message;
+		long long seq;
+		std::string sql;
+		std::string params;
+	};
+	tll::duration _slow_threshold = {};
+	tll::duration _slow_interval = {}; // Minimal interval between log records
+	std::vector<SlowStatement> _slow_ring;
+	size_t _slow_count = 0;
+	tll::time_point _slow_logged = {};
+	unsigned _slow_suppressed = 0;
+	std::string _select_query;
+
+	struct CacheEntry {
+		std::string key;
+		std::string table;
+		tll::time_point time;
+		std::shared_ptr<const Fetcher::Block> data;
+	};
+	std::list<CacheEntry> _cache; // Oldest entries first
+	std::map<std::string, std::list<CacheEntry>::iterator, std::less<>> _cache_index;
+	size_t _cache_size = 0;
+	size_t _cache_limit = 0;
+	tll::duration _cache_ttl = {};
+	std::unique_ptr<Fetcher::Block> _cache_fill; // Rows of current query that are recorded
+	std::string _cache_key;
+	std::string _cache_table;
+	std::shared_ptr<const Fetcher::Block> _cache_replay;
+	size_t _cache_offset = 0;
+
+	struct Batch {
+		const tll::scheme::Message * message = nullptr;
+		const tll::scheme::Field * seq = nullptr;
+		std::vector<std::pair<const tll::scheme::Field *, const tll::scheme::Field *>> columns; // Batch list field, row field
+	};
+	unsigned _batch_size = 0;
+	int _batch_id_offset = 0;
+	std::map<int, Batch> _batch; // Row message id -> batch message
+	std::set<int> _batch_ids;
+	std::set<int> _prepare_failed; // Messages that failed lazy prepare, not retried until reopen
+	Fetcher::Block _batch_rows;
+	int _batch_msgid = 0; // Row message id of pending rows
+	std::vector<char> _batch_buf;
+	std::list<std::unique_ptr<Fetcher>> _fetchers;
+	SQLHandle<SQL_HANDLE_DBC> _prefetch_db; // Kept between queries, channel connection stays free for other statements
+	std::vector<SQLHandle<SQL_HANDLE_DBC>> _pool; // Connections for parallel and merged reads, kept until close
+	Fetcher::Block _fetch_data;
+	std::vector<std::unique_ptr<MergeCursor>> _merge; // Heap of cursors with non-empty blocks ordered by seq
 
  public:
 	static constexpr auto process_policy() { return ProcessPolicy::Custom; }
@@ -419,11 +1173,132 @@ class ODBC : public tll::channel::Base<ODBC>
 	int _process(long timeout, int flags);
 
  private:
-	int _create_table(std::string_view table, const tll::scheme::Message *);
+	int _connect(SQLHandle<SQL_HANDLE_DBC> &db);
+	int _pool_get(SQLHandle<SQL_HANDLE_DBC> &db);
+	int _alloc_env();
+	int _connect_shared();
+	void _disconnect();
+	void _connection_lost() { if (_shared_lost) *_shared_lost = true; }
+	bool _shared_check() { return _shared_lost && *_shared_lost; }
+	// HYTxx is reported by most drivers, PostgreSQL driver implements timeout with statement_timeout
+	bool _timeout_state() const { return _sqlstate == "HYT00" || _sqlstate == "HYT01" || _sqlstate == "57014"; }
+	std::string _shared_key() const;
+	int _create_table(std::string_view table, const Prepared &);
+	int _check_table(std::string_view table, CatalogTable &, const Prepared &);
+	int _load_catalog();
+	std::string _current_schema();
+	CatalogTable * _catalog_find(std::string_view table);
+	int _load_indexes(std::string_view table, CatalogTable &);
+	std::vector<std::pair<std::string_view, bool>> _table_indexes(const Prepared &);
 	int _create_query(const tll::scheme::Message *);
+	void _init_convert(Prepared::Convert &, const tll::scheme::Field *);
+	int _link_output(Prepared &);
+	Prepared * _lookup(int msgid);
 	int _create_index(const std::string_view &name, std::string_view key, bool unique);
+	int _build_index(const std::string_view &name, std::string_view key, bool unique);
+	int _build_deferred_index();
+
+	int _insert(Prepared &prepared, const tll_msg_t *msg);
+	int _insert_rows(Prepared &prepared, const tll_msg_t *msg);
+	int _spill_push(const tll_msg_t *msg);
+	int _spill_drain(size_t count);
+	int _spill_flush() { return _spill_drain(std::numeric_limits<size_t>::max()); }
+	void _update_pending();
+
+	int _execute(query_ptr_t &query, std::string_view message, int msgid = 0, long long seq = 0, size_t rows = 0);
+	int _ping(const tll_msg_t *msg);
+
+	int _retention_prepare(Prepared &prepared);
+	int _retention_purge(Prepared &prepared);
+	int _on_retention(const tll::Channel *, const tll_msg_t *);
+
+	int _begin();
+	int _end_transaction(SQLSMALLINT completion);
+	void _written(long long seq)
+	{
+		if (_transaction)
+			_pending_seq = std::max(_pending_seq, seq);
+		else
+			_committed(seq);
+	}
+	void _committed(long long seq);
+	int _bind_columns(query_ptr_t &query, Prepared * select, std::vector<char> &buf, long long &seq, SQLLEN &seq_param);
+	int _bind_columns(query_ptr_t &query, Prepared * select) { return _bind_columns(query, select, _buf, _msg.seq, _seq_param); }
+	int _unpack(Prepared &select, std::vector<char> &buf, size_t &size);
+	int _fetch_blob(query_ptr_t &query, int idx, size_t &size);
+
+	std::string _partition_table(const Prepared &prepared, long period);
+	query_ptr_t * _partition(Prepared &prepared, long period);
+	int _partition_switch(Prepared &prepared, long period);
+
+	int _query_parallel(Prepared &select, std::string_view columns, const std::list<std::string> &where, const std::vector<Parameter> &params);
+	int _fetcher_add(Prepared &select, bool connect, std::string_view query, std::vector<Parameter> &&params);
+	void _fetch_start(Prepared &select);
+
+	using slow_clock = std::chrono::steady_clock;
+	slow_clock::time_point _slow_start() const
+	{
+		if (_slow_threshold.count() == 0)
+			return {};
+		return slow_clock::now();
+	}
+
+	// Parameters are rendered only if statement took longer then threshold
+	template <typename Render>
+	void _slow_check(slow_clock::time_point start, std::string_view stage, const Prepared &prepared, std::string_view sql, long long seq, Render render)
+	{
+		if (_slow_threshold.count() == 0)
+			return;
+		auto elapsed = std::chrono::duration_cast<tll::duration>(slow_clock::now() - start);
+		if (elapsed >= _slow_threshold)
+			_slow_record(elapsed, stage, prepared, sql, seq, render());
+	}
+
+	void _slow_record(tll::duration elapsed, std::string_view stage, const Prepared &prepared, std::string_view sql, long long seq, std::string params);
+	int _slow_dump();
+
+	void _emit_data(const tll_msg_t *msg)
+	{
+		if (_cache_fill) {
+			_cache_fill->push_back(msg->seq, msg->data, msg->size);
+			if (_cache_fill->data.size() > _cache_limit) {
+				_log.debug("Query result is larger then cache size, not cached");
+				_cache_fill.reset();
+			}
+		}
+		if (_batch_size) {
+			if (_batch_rows.count && _batch_msgid != msg->msgid) // Merged query switched message
+				_batch_flush();
+			_batch_msgid = msg->msgid;
+			_batch_rows.push_back(msg->seq, msg->data, msg->size);
+			if (_batch_rows.count >= _batch_size)
+				_batch_flush();
+			return;
+		}
+		_callback_data(msg);
+	}
 
-	int _execute(query_ptr_t &query, std::string_view message);
+	int _batch_scheme();
+	void _batch_flush();
+
+	void _end_of_data(odbc_scheme::EndOfData::Status status = odbc_scheme::EndOfData::Status::Ok);
+	int _cancel();
+	bool _cache_lookup(Prepared &select);
+	void _cache_store();
+	void _cache_erase(std::list<CacheEntry>::iterator it);
+	void _cache_invalidate(std::string_view table);
+	int _process_cache();
+	int _spool_fill();
+	int _process_spool();
+	int _check_query(const tll_msg_t *msg);
+	int _merge_query(const tll_msg_t *msg);
+	int _merge_fill(MergeCursor &cursor);
+	int _process_merge();
+	void _fetch_run(Fetcher &fetcher);
+	int _process_fetch();
+	void _fetch_stop();
+	int _partition_tables(const Prepared &prepared, std::vector<std::pair<long, std::string>> &result);
+	int _on_partition(const tll::Channel *, const tll_msg_t *);
 
 	std::string _quoted(std::string_view name) // Can only be used for table/field names, no escaping performed
 	{
@@ -444,6 +1319,54 @@ class ODBC : public tll::channel::Base<ODBC>
 		return _quoted(name.substr(0, dot)) + "." + _quoted(name.substr(dot + 1));
 	}
 
+	std::string_view _blob_type()
+	{
+		switch (_quotes) {
+		case Quotes::PSQL: return "BYTEA";
+		case Quotes::Sybase: return "VARBINARY(MAX)";
+		case Quotes::SQLite:
+		case Quotes::None:
+			return "BLOB";
+		}
+		return "BLOB";
+	}
+
+	// Session settings for durability/throughput tradeoff, dialect is selected by quoting mode
+	std::vector<std::string_view> _profile_sql()
+	{
+		switch (_quotes) {
+		case Quotes::SQLite:
+			switch (_profile) {
+			case Profile::None: return {};
+			case Profile::Durable: return {"PRAGMA journal_mode=WAL", "PRAGMA synchronous=FULL"};
+			case Profile::Fast: return {"PRAGMA journal_mode=WAL", "PRAGMA synchronous=NORMAL"};
+			case Profile::Bulk: return {"PRAGMA journal_mode=WAL", "PRAGMA synchronous=OFF", "PRAGMA temp_store=MEMORY", "PRAGMA cache_size=-65536"};
+			}
+			break;
+		case Quotes::PSQL:
+			switch (_profile) {
+			case Profile::None: return {};
+			case Profile::Durable: return {"SET synchronous_commit TO on"};
+			case Profile::Fast: return {"SET synchronous_commit TO off"};
+			case Profile::Bulk: return {"SET synchronous_commit TO off", "SET maintenance_work_mem TO '512MB'"};
+			}
+			break;
+		case Quotes::Sybase:
+			switch (_profile) {
+			case Profile::None:
+			case Profile::Durable:
+				return {};
+			case Profile::Fast:
+			case Profile::Bulk:
+				return {"SET NOCOUNT ON"};
+			}
+			break;
+		case Quotes::None:
+			break;
+		}
+		return {};
+	}
+
 	std::string_view _if_not_exists()
 	{
 		if (_create_mode == Create::Checked)
@@ -451,30 +1374,78 @@ class ODBC : public tll::channel::Base<ODBC>
 		return "";
 	}
 
-	query_ptr_t _prepare(const std::string_view query)
+	query_ptr_t _alloc()
 	{
-		_log.debug("Prepare SQL statement:\n\t{}", query);
 		SQLHSTMT ptr;
 		if (auto r = SQLAllocHandle(SQL_HANDLE_STMT, _db, &ptr); r != SQL_SUCCESS)
-			return _log.fail(query_ptr_t {}, "Failed to allocate statement: {}\n\t{}", odbcerror(_db), query);
+			return _log.fail(query_ptr_t {}, "Failed to allocate statement: {}", odbcerror(_db));
 		query_ptr_t sql;
 		sql.reset(ptr);
-		if (auto r = SQLPrepare(sql, (SQLCHAR *) query.data(), query.size()); r != SQL_SUCCESS)
-			return _log.fail(query_ptr_t {}, "Failed to prepare statement: {}\n\t{}", odbcerror(sql), query);
 		return sql;
 	}
 
-	template <SQLSMALLINT Type>
-	std::string_view odbcerror(SQLHandle<Type> &handle) { return _odbcerror(Type, handle); }
+	query_ptr_t _prepare(const std::string_view query, int msgid = 0) { return _prepare(_db, query, msgid); }
 
-	std::string_view _odbcerror(const SQLSMALLINT type, void *handle)
+	// Select statements are kept and reused for same SQL text
+	query_ptr_t _prepare_select(const std::string &query, int msgid)
 	{
-		auto view = tll::make_view(_errorbuf);
-		_sqlstate = "";
-
-		for (auto i = 1; ; i++) {
-			if (view.size() < 9)
-				view.resize(9); // One byte for internal strnlen inside SQLGetDiagRec
+		if (_statement_cache == 0)
+			return _with_timeout(_prepare(query, msgid));
+		if (auto it = _statements.find(query); it != _statements.end()) {
+			_log.debug("Reuse prepared statement:\n\t{}", query);
+			SQLFreeStmt(it->second, SQL_CLOSE);
+			SQLFreeStmt(it->second, SQL_UNBIND);
+			SQLFreeStmt(it->second, SQL_RESET_PARAMS);
+			return it->second;
+		}
+		auto sql = _with_timeout(_prepare(query, msgid));
+		if (!sql)
+			return sql;
+		if (_statements.size() >= _statement_cache)
+			_statements.clear();
+		_statements.emplace(query, sql);
+		return sql;
+	}
+	// Message id is passed to probes, zero for statements not bound to message (catalog, indexes, session)
+	query_ptr_t _prepare(SQLHandle<SQL_HANDLE_DBC> &db, const std::string_view query, int msgid = 0)
+	{
+		_log.debug("Prepare SQL statement:\n\t{}", query);
+		SQLHSTMT ptr;
+		if (auto r = SQLAllocHandle(SQL_HANDLE_STMT, db, &ptr); r != SQL_SUCCESS)
+			return _log.fail(query_ptr_t {}, "Failed to allocate statement: {}\n\t{}", odbcerror(db), query);
+		query_ptr_t sql;
+		sql.reset(ptr);
+		ODBC_PROBE(prepare_start, msgid, 0, 0, 0);
+		auto r = SQLPrepare(sql, (SQLCHAR *) query.data(), query.size());
+		ODBC_PROBE(prepare_done, msgid, 0, 0, r);
+		if (r != SQL_SUCCESS)
+			return _log.fail(query_ptr_t {}, "Failed to prepare statement: {}\n\t{}", odbcerror(sql), query);
+		return sql;
+	}
+
+	// Timeout is set only on select statements, table and index builds or inserts are not limited
+	query_ptr_t _with_timeout(query_ptr_t sql)
+	{
+		if (!sql || !_query_timeout.count())
+			return sql;
+		// Timeout is set in whole seconds
+		auto seconds = std::chrono::ceil<std::chrono::seconds>(_query_timeout).count();
+		if (auto r = SQLSetStmtAttr(sql, SQL_ATTR_QUERY_TIMEOUT, (SQLPOINTER) (SQLULEN) seconds, 0); !SQL_SUCCEEDED(r))
+			_log.warning("Failed to set query timeout: {}", odbcerror(sql));
+		return sql;
+	}
+
+	template <SQLSMALLINT Type>
+	std::string_view odbcerror(SQLHandle<Type> &handle) { return _odbcerror(Type, handle); }
+
+	std::string_view _odbcerror(const SQLSMALLINT type, void *handle)
+	{
+		auto view = tll::make_view(_errorbuf);
+		_sqlstate = "";
+
+		for (auto i = 1; ; i++) {
+			if (view.size() < 9)
+				view.resize(9); // One byte for internal strnlen inside SQLGetDiagRec
 			view.dataT<char>()[0] = 0;
 			view.dataT<char>()[8] = 0;
 			SQLSMALLINT len = 0;
@@ -524,9 +1495,88 @@ int ODBC::_init(const Channel::Url &url, Channel * master)
 	_create_mode = reader.getT("create-mode", Create::No, {{"no", Create::No}, {"checked", Create::Checked}, {"always", Create::Always}});
 	_quotes = reader.getT("quote-mode", Quotes::PSQL, {{"sqlite", Quotes::SQLite}, {"psql", Quotes::PSQL}, {"sybase", Quotes::Sybase}, {"none", Quotes::None}});
 	_function_mode = reader.getT("function-mode", Function::Fields, {{"fields", Function::Fields}, {"empty", Function::Empty}});
+	_index_mode = reader.getT("index-mode", IndexMode::Immediate, {{"immediate", IndexMode::Immediate}, {"deferred", IndexMode::Deferred}});
+	_prepare_mode = reader.getT("prepare", PrepareMode::Eager, {{"eager", PrepareMode::Eager}, {"lazy", PrepareMode::Lazy}});
+	_prepare_list = reader.getT("prepare-list", std::string());
+	_profile = reader.getT("session-profile", Profile::None, {{"none", Profile::None}, {"durable", Profile::Durable}, {"fast", Profile::Fast}, {"bulk", Profile::Bulk}});
+	auto init_sql = reader.getT("init-sql", std::string());
+	_ping_query = reader.getT("ping-query", std::string("SELECT 1"));
 	_strict = reader.getT("strict", true);
+	_string_size = reader.getT("string-size", 1024u);
+	_spill_file = reader.getT("spill", std::string());
+	_spill_latency = reader.getT<tll::duration>("spill-latency", std::chrono::milliseconds(100));
+	_spill_size = reader.getT<tll::util::Size>("spill-size", 64 * 1024 * 1024);
+	_spool = reader.getT("spool", false);
+	_spool_file = reader.getT("spool-file", std::string());
+	_spool_size = reader.getT<tll::util::Size>("spool-size", 64 * 1024 * 1024);
+	_parallel = reader.getT("parallel", 1u);
+	_fetch_order = reader.getT("parallel-order", FetchOrder::Seq, {{"seq", FetchOrder::Seq}, {"none", FetchOrder::None}});
+	_fetch_block = reader.getT<size_t>("fetch-block", 1024);
+	_fetch_depth = reader.getT<size_t>("prefetch-depth", 2);
+	_parallel_depth = reader.getT<size_t>("parallel-depth", 16);
+	_prefetch = reader.getT("prefetch", false);
+	_slow_threshold = reader.getT<tll::duration>("slow-threshold", tll::duration {});
+	_slow_interval = reader.getT<tll::duration>("slow-interval", std::chrono::seconds(1));
+	auto slow_ring = reader.getT("slow-ring", 32u);
+	_cache_limit = reader.getT<tll::util::Size>("cache-size", 16 * 1024 * 1024);
+	_cache_ttl = reader.getT<tll::duration>("cache-ttl", std::chrono::seconds(60));
+	_batch_size = reader.getT("batch", 0u);
+	_batch_id_offset = reader.getT("batch-id-offset", 100000);
+	_commit_ack = reader.getT("commit-ack", false);
+	_shared = reader.getT("shared-connection", false);
+	_query_timeout = reader.getT<tll::duration>("query-timeout", tll::duration {});
+	_statement_cache = reader.getT<size_t>("statement-cache", 64);
+	_max_params = reader.getT<size_t>("max-parameters", 2000);
+	_retention_interval = reader.getT<tll::duration>("retention-interval", std::chrono::seconds(1));
+	_partition_interval = reader.getT<tll::duration>("partition-interval", std::chrono::seconds(1));
+	_retention_chunk = reader.getT("retention-chunk", 1000u);
 	if (!reader)
 		return _log.fail(EINVAL, "Invalid url: {}", reader.error());
+	if (_string_size < 2)
+		return _log.fail(EINVAL, "String size is too small: {}", _string_size);
+	if (_parallel == 0)
+		return _log.fail(EINVAL, "Zero parallel connections");
+	if (_fetch_block == 0)
+		return _log.fail(EINVAL, "Zero fetch block size");
+	if (_fetch_depth == 0)
+		return _log.fail(EINVAL, "Zero prefetch depth");
+	if (_parallel_depth == 0)
+		return _log.fail(EINVAL, "Zero parallel depth");
+	if (slow_ring == 0)
+		return _log.fail(EINVAL, "Zero slow statement ring size");
+	if (_retention_interval.count() <= 0)
+		return _log.fail(EINVAL, "Invalid retention interval: {}", _retention_interval);
+	if (_partition_interval.count() <= 0)
+		return _log.fail(EINVAL, "Invalid partition interval: {}", _partition_interval);
+	if (_retention_chunk == 0)
+		return _log.fail(EINVAL, "Zero retention chunk size");
+	if (_shared && !_spool) {
+		// Cursor left open between calls would block statements of other channels
+		_log.info("Query results are spooled on shared connection");
+		_spool = true;
+	}
+	_slow_ring.resize(slow_ring);
+
+	_init_sql.clear();
+	if (_profile != Profile::None && _quotes == Quotes::None)
+		_log.warning("Session profile is not defined for quote mode 'none', only init-sql is used");
+	for (auto & str : _profile_sql())
+		_init_sql.emplace_back(str);
+	for (auto str : split(init_sql, ';')) {
+		auto first = str.find_first_not_of(" \t\n");
+		if (first == str.npos)
+			continue;
+		str = str.substr(first, str.find_last_not_of(" \t\n") - first + 1);
+		_init_sql.emplace_back(str);
+	}
+	if (auto sub = url.sub("init-sql"); sub) { // Semicolon can not be used in url, so list can be given as init-sql.N keys
+		// Each item is one statement and is not split, it may contain semicolons in literals or bodies
+		for (auto &[k, c] : sub->browse("*")) {
+			auto v = c.get();
+			if (v && v->size())
+				_init_sql.emplace_back(*v);
+		}
+	}
 
 	if (auto sub = url.sub("settings"); sub) {
 		for (auto &[k, c] : sub->browse("*")) {
@@ -567,6 +1617,93 @@ int ODBC::_open(const tll::ConstConfig &s)
 	if (auto r = Base::_open(s); r)
 		return _log.fail(r, "Failed to open ODBC database");
 
+	_batch.clear();
+	_batch_ids.clear();
+	_batch_rows.clear();
+	if (_batch_size && _batch_scheme())
+		return _log.fail(EINVAL, "Failed to build columnar batch scheme");
+
+	if (_shared) {
+		if (auto r = _connect_shared(); r)
+			return r;
+	} else {
+		if (auto r = _alloc_env(); r)
+			return r;
+		if (auto r = _connect(_db); r)
+			return r;
+	}
+
+	if (_create_mode == Create::Checked) {
+		if (_load_catalog())
+			return _log.fail(EINVAL, "Failed to load database catalog");
+	}
+
+	if (_prepare_mode == PrepareMode::Lazy) {
+		// Only messages from warm-up list are prepared, others are handled on first use
+		for (auto & name : split(_prepare_list, ',')) {
+			auto m = _scheme->lookup(name);
+			if (!m)
+				return _log.fail(EINVAL, "Message '{}' from prepare list not found in scheme", name);
+			if (m->msgid == 0)
+				return _log.fail(EINVAL, "Message '{}' from prepare list has no msgid", name);
+			if (!_lookup(m->msgid))
+				return _log.fail(EINVAL, "Failed to prepare SQL statement for '{}'", name);
+		}
+	} else {
+		for (auto & m : tll::util::list_wrap(_scheme->messages)) {
+			if (m.msgid == 0) {
+				_log.debug("Message {} has no msgid, skip table check", m.name);
+				continue;
+			}
+			if (_batch_ids.count(m.msgid)) {
+				_log.debug("Message {} is columnar batch, skip table check", m.name);
+				continue;
+			}
+
+			if (_create_query(&m)) {
+				if (_strict)
+					return _log.fail(EINVAL, "Failed to prepare SQL statement for '{}'", m.name);
+				_log.warning("Failed to prepare SQL statement for '{}'", m.name);
+			}
+		}
+
+		for (auto & [_, m] : _messages) {
+			if (_link_output(m))
+				return _log.fail(EINVAL, "Output message {} was not prepared", m.output_message->name);
+		}
+	}
+
+	_transaction = false;
+	_committed_seq = _pending_seq = -1;
+
+	_spool_active = false;
+	_spool_temp = false;
+	if (_spool && _spool_file.empty()) {
+		auto dir = getenv("TMPDIR");
+		std::string name = fmt::format("{}/tll-odbc-spool-XXXXXX", dir && *dir ? dir : "/tmp");
+		auto fd = mkstemp(name.data());
+		if (fd == -1)
+			return _log.fail(EINVAL, "Failed to create spool file '{}': {}", name, strerror(errno));
+		::close(fd);
+		_spool_file = name;
+		_spool_temp = true;
+	}
+
+	if (_spill_file.size()) {
+		if (auto r = _journal.open(_spill_file, _spill_size); r)
+			return _log.fail(EINVAL, "Failed to open spill journal '{}': {}", _spill_file, strerror(r));
+		_spill_active = false;
+		if (!_journal.empty()) {
+			_log.info("Spill journal has {} bytes of pending messages", _journal.used());
+			_update_pending();
+		}
+	}
+
+	return 0;
+}
+
+int ODBC::_alloc_env()
+{
 	SQLHENV henv = nullptr;
 	if (auto r = SQLAllocHandle(SQL_HANDLE_ENV, SQL_NULL_HANDLE, &henv); r != SQL_SUCCESS)
 		return _log.fail(EINVAL, "Failed to allocate ODBC Environment: {}", r);
@@ -574,102 +1711,424 @@ int ODBC::_open(const tll::ConstConfig &s)
 
         if (auto r = SQLSetEnvAttr(_env, SQL_ATTR_ODBC_VERSION, (SQLPOINTER)SQL_OV_ODBC3, 0); r != SQL_SUCCESS)
 		return _log.fail(EINVAL, "Failed to request ODBCv3: {}", odbcerror(_env));
+	return 0;
+}
+
+std::string ODBC::_shared_key() const
+{
+	// Session statements change connection state so they are part of the key
+	auto r = _settings;
+	for (auto & str : _init_sql)
+		r += "\n" + str;
+	return r;
+}
+
+int ODBC::_connect_shared()
+{
+	auto & registry = Registry::instance();
+	std::unique_lock<std::mutex> lock(registry.lock);
+
+	_env.ptr = registry.env.lock();
+	if (!_env) {
+		if (auto r = _alloc_env(); r)
+			return r;
+		registry.env = _env.ptr;
+	}
+
+	auto key = _shared_key();
+	auto it = registry.connections.find(key);
+	if (it != registry.connections.end() && !*it->second.lost) {
+		_db.ptr = it->second.db.lock();
+		if (_db) {
+			_shared_lost = it->second.lost;
+			_log.info("Use shared connection, {} users", _db.ptr.use_count() - 1);
+			return 0;
+		}
+	}
 
+	// Lost connection is replaced, its remaining users fail on next call
+	if (auto r = _connect(_db); r)
+		return r;
+	_shared_lost.reset(new std::atomic<bool>(false));
+	registry.connections[key] = { _db.ptr, _shared_lost };
+	return 0;
+}
+
+void ODBC::_disconnect()
+{
+	if (!_shared) {
+		SQLDisconnect(_db);
+		_db.reset();
+		return;
+	}
+
+	// Last user disconnects, lock prevents concurrent open from picking up connection in the middle
+	auto & registry = Registry::instance();
+	std::unique_lock<std::mutex> lock(registry.lock);
+	if (_db.ptr.use_count() == 1) {
+		_log.info("Close shared connection");
+		SQLDisconnect(_db);
+		if (auto it = registry.connections.find(_shared_key()); it != registry.connections.end() && it->second.lost == _shared_lost)
+			registry.connections.erase(it);
+	}
+	_db.reset();
+	_shared_lost.reset();
+}
+
+int ODBC::_connect(SQLHandle<SQL_HANDLE_DBC> &db)
+{
 	SQLHDBC hdbc = nullptr;
 	if (auto r = SQLAllocHandle(SQL_HANDLE_DBC, _env, &hdbc); r != SQL_SUCCESS)
 		return _log.fail(EINVAL, "Failed to allocate ODBC Connection: {}", odbcerror(_env));
-	_db.reset(hdbc);
+	db.reset(hdbc);
 
 	char buf[SQL_MAX_OPTION_STRING_LENGTH];
 	SQLSMALLINT buflen = sizeof(buf);
-	if (auto r = SQLDriverConnect (_db, nullptr, (SQLCHAR *) _settings.data(), _settings.size(),
+	if (auto r = SQLDriverConnect (db, nullptr, (SQLCHAR *) _settings.data(), _settings.size(),
                                (SQLCHAR *) buf, sizeof(buf), &buflen, SQL_DRIVER_NOPROMPT); !SQL_SUCCEEDED(r)) {
-		return _log.fail(EINVAL, "Failed to connect: {}\n\tConnection string: {}", odbcerror(_db), _settings);
+		auto error = odbcerror(db);
+		db.reset();
+		return _log.fail(EINVAL, "Failed to connect: {}\n\tConnection string: {}", error, _settings);
 	}
 	_log.info("Connection string: {}", buf); //std::string_view(buf, buflen));
 
-	for (auto & m : tll::util::list_wrap(_scheme->messages)) {
-		if (m.msgid == 0) {
-			_log.debug("Message {} has no msgid, skip table check", m.name);
-			continue;
-		}
-
-		if (_create_query(&m)) {
-			if (_strict)
-				return _log.fail(EINVAL, "Failed to prepare SQL statement for '{}'", m.name);
-			_log.warning("Failed to prepare SQL statement for '{}'", m.name);
-		}
+	for (auto & str : _init_sql) {
+		_log.debug("Execute session statement: {}", str);
+		auto sql = _prepare(db, str);
+		if (!sql)
+			return _log.fail(EINVAL, "Failed to prepare session statement: {}", str);
+		if (auto r = SQLExecute(sql); !SQL_SUCCEEDED(r) && r != SQL_NO_DATA)
+			return _log.fail(EINVAL, "Failed to execute session statement: {}\n\t{}", odbcerror(sql), str);
+		SQLFreeStmt(sql, SQL_CLOSE);
 	}
+	return 0;
+}
 
-	for (auto & [_, m] : _messages) {
-		using tll::scheme::Field;
-		if (m.output_message) {
-			auto it = _messages.find(m.output_message->msgid);
-			if (it == _messages.end())
-				return _log.fail(EINVAL, "Output message {} was not prepared", m.output_message->name);
-			m.output = &it->second;
-		}
-		auto ibuf = _string_buffers.begin();
-		auto i = 0;
-		for (auto & f : tll::util::list_wrap(m.message->fields)) {
-			if (&f == m.message->pmap)
-				continue;
-			auto & conv = m.convert[i++];
-			conv.field = &f;
-			if (f.type == Field::Pointer && f.type_ptr->type == Field::Int8 && f.sub_type == Field::ByteString) {
-				conv.type = Prepared::Convert::String;
-				if (ibuf == _string_buffers.end()) {
-					_string_buffers.push_back({});
-					ibuf = --_string_buffers.end();
-				}
-				ibuf->resize(1024);
-				conv.string = ibuf->data();
-				conv.string_size = ibuf->size();
-				ibuf++;
-			} else if (f.type == Field::Bytes && f.sub_type == Field::ByteString) {
-				conv.type = Prepared::Convert::String;
-				conv.string_size = f.size + 1;
-				conv.bytestring_data.reset(new char[conv.string_size]);
-				conv.string = conv.bytestring_data.get();
-			} else if (f.type == Field::Decimal128) {
-				conv.type = Prepared::Convert::Numeric;
-			} else if (f.sub_type == Field::TimePoint) {
-				conv.type = Prepared::Convert::Timestamp;
-			}
+int ODBC::_pool_get(SQLHandle<SQL_HANDLE_DBC> &db)
+{
+	// Connection is idle when only pool holds reference to it
+	for (auto & c : _pool) {
+		if (c.ptr.use_count() != 1)
+			continue;
+		SQLUINTEGER dead = SQL_CD_FALSE;
+		if (auto r = SQLGetConnectAttr(c, SQL_ATTR_CONNECTION_DEAD, &dead, 0, nullptr); SQL_SUCCEEDED(r) && dead == SQL_CD_TRUE) {
+			_log.info("Pooled connection is lost, reconnect");
+			SQLDisconnect(c);
+			if (_connect(c))
+				return EINVAL;
 		}
+		db = c;
+		return 0;
 	}
 
+	SQLHandle<SQL_HANDLE_DBC> c;
+	if (_connect(c))
+		return EINVAL;
+	_log.debug("Add connection to pool, {} total", _pool.size() + 1);
+	db = _pool.emplace_back(std::move(c));
 	return 0;
 }
 
+int ODBC::_link_output(Prepared &prepared)
+{
+	if (!prepared.output_message)
+		return 0;
+	prepared.output = _lookup(prepared.output_message->msgid);
+	if (!prepared.output)
+		return EINVAL;
+	return 0;
+}
+
+Prepared * ODBC::_lookup(int msgid)
+{
+	if (auto it = _messages.find(msgid); it != _messages.end())
+		return &it->second;
+	if (_prepare_mode != PrepareMode::Lazy || _prepare_failed.count(msgid))
+		return nullptr;
+
+	auto msg = _scheme->lookup(msgid);
+	if (!msg)
+		return nullptr;
+	_log.debug("Prepare SQL statement for '{}' on first use", msg->name);
+	if (_create_query(msg)) {
+		_prepare_failed.insert(msgid);
+		if (_strict)
+			return _log.fail(nullptr, "Failed to prepare SQL statement for '{}'", msg->name);
+		_log.warning("Failed to prepare SQL statement for '{}', message is skipped", msg->name);
+		return nullptr;
+	}
+	auto & prepared = _messages.find(msgid)->second;
+	if (_link_output(prepared)) {
+		_log.error("Output message {} for '{}' was not prepared", prepared.output_message->name, msg->name);
+		_messages.erase(msgid);
+		_prepare_failed.insert(msgid);
+		return nullptr;
+	}
+	return &prepared;
+}
+
 int ODBC::_close()
 {
+	if (_db.ptr && _deferred_index.size()) {
+		if (_build_deferred_index())
+			_log.error("Failed to create deferred indexes");
+	}
+	_deferred_index.clear();
+	_catalog.clear();
+	if (_db.ptr && _transaction) {
+		_log.warning("Rollback unfinished transaction");
+		SQLEndTran(SQL_HANDLE_DBC, _db, SQL_ROLLBACK);
+	}
+	_transaction = false;
+	if (_retention_timer)
+		_retention_timer->close();
+	if (_partition_timer)
+		_partition_timer->close();
+	_journal.close();
+	_spool_journal.close();
+	_spool_mapped = 0;
+	_spool_active = false;
+	if (_spool_temp) {
+		unlink(_spool_file.c_str());
+		_spool_file.clear();
+		_spool_temp = false;
+	}
+	_fetch_stop();
+	if (_prefetch_db.ptr)
+		SQLDisconnect(_prefetch_db);
+	_prefetch_db.reset();
+	_merge.clear();
+	for (auto & db : _pool)
+		SQLDisconnect(db);
+	_pool.clear();
+	_cache.clear();
+	_cache_index.clear();
+	_cache_size = 0;
+	_cache_fill.reset();
+	_cache_replay.reset();
+
 	_select = nullptr;
 	_messages.clear();
+	_prepare_failed.clear();
+	_rows_seq.clear();
+	_statements.clear();
 	_select_sql.reset();
+	_ping_sql.reset();
 	if (_db.ptr)
-		SQLDisconnect(_db);
+		_disconnect();
 	_db.reset();
 	_env.reset();
 	return Base::_close();
 }
 
-int ODBC::_create_table(std::string_view table, const tll::scheme::Message * msg)
+int ODBC::_load_catalog()
+{
+	_catalog.clear();
+	_catalog_schema = _current_schema();
+
+	auto sql = _alloc();
+	if (!sql)
+		return EINVAL;
+
+	// Columns of all tables are read with single call
+	if (auto r = SQLColumns(sql, nullptr, 0, nullptr, 0, (SQLCHAR *) "%", SQL_NTS, (SQLCHAR *) "%", SQL_NTS); !SQL_SUCCEEDED(r))
+		return _log.fail(EINVAL, "Failed to list columns: {}", odbcerror(sql));
+
+	char schema[256], table[256], column[256];
+	SQLLEN schema_len = 0, table_len = 0, column_len = 0, type_len = 0;
+	SQLSMALLINT type = 0;
+	SQLBindCol(sql, 2, SQL_C_CHAR, schema, sizeof(schema), &schema_len);
+	SQLBindCol(sql, 3, SQL_C_CHAR, table, sizeof(table), &table_len);
+	SQLBindCol(sql, 4, SQL_C_CHAR, column, sizeof(column), &column_len);
+	SQLBindCol(sql, 5, SQL_C_SSHORT, &type, sizeof(type), &type_len);
+
+	// Without known current schema unqualified names are also added, same named tables from different schemas are merged
+	auto alias = _catalog_schema.empty();
+	SQLRETURN r;
+	while (SQL_SUCCEEDED(r = SQLFetch(sql))) {
+		if (table_len == SQL_NULL_DATA || column_len == SQL_NULL_DATA)
+			continue;
+		std::string name(table, strnlen(table, sizeof(table)));
+		std::string cname(column, strnlen(column, sizeof(column)));
+		std::string_view sname;
+		if (schema_len != SQL_NULL_DATA && schema_len > 0)
+			sname = std::string_view(schema, strnlen(schema, sizeof(schema)));
+		if (sname.empty() || alias)
+			_catalog[name].columns[cname] = type;
+		if (sname.size()) {
+			auto & info = _catalog[fmt::format("{}.{}", sname, name)];
+			info.columns[cname] = type;
+			info.schema = sname;
+		}
+	}
+	if (r != SQL_NO_DATA)
+		return _log.fail(EINVAL, "Failed to fetch columns: {}", odbcerror(sql));
+	_log.debug("Loaded {} tables from catalog", _catalog.size());
+	return 0;
+}
+
+std::string ODBC::_current_schema()
+{
+	std::string_view query;
+	switch (_quotes) {
+	case Quotes::PSQL: query = "SELECT current_schema()"; break;
+	case Quotes::Sybase: query = "SELECT SCHEMA_NAME()"; break;
+	case Quotes::SQLite: return ""; // No schemas
+	case Quotes::None: return "";
+	}
+
+	auto sql = _prepare(query);
+	if (!sql)
+		return "";
+	char buf[256];
+	SQLLEN len = 0;
+	if (_execute(sql, "select") || !SQL_SUCCEEDED(SQLFetch(sql)) || !SQL_SUCCEEDED(SQLGetData(sql, 1, SQL_C_CHAR, buf, sizeof(buf), &len)) || len == SQL_NULL_DATA) {
+		_log.warning("Failed to get current schema, unqualified table names are matched in all schemas");
+		return "";
+	}
+	SQLCloseCursor(sql);
+	_log.debug("Current schema: {}", buf);
+	return std::string(buf, strnlen(buf, sizeof(buf)));
+}
+
+ODBC::CatalogTable * ODBC::_catalog_find(std::string_view table)
+{
+	auto it = _catalog.find(table);
+	if (it == _catalog.end() && _catalog_schema.size() && table.find('.') == table.npos)
+		it = _catalog.find(fmt::format("{}.{}", _catalog_schema, table));
+	if (it == _catalog.end())
+		return nullptr;
+	return &it->second;
+}
+
+int ODBC::_load_indexes(std::string_view table, CatalogTable &info)
+{
+	auto sql = _alloc();
+	if (!sql)
+		return EINVAL;
+
+	std::string schema, name(table);
+	if (auto dot = table.find('.'); dot != table.npos) {
+		schema = table.substr(0, dot);
+		name = table.substr(dot + 1);
+	}
+
+	if (auto r = SQLStatistics(sql, nullptr, 0, schema.size() ? (SQLCHAR *) schema.data() : nullptr, schema.size(),
+				(SQLCHAR *) name.data(), name.size(), SQL_INDEX_ALL, SQL_QUICK); !SQL_SUCCEEDED(r))
+		return _log.fail(EINVAL, "Failed to list indexes for '{}': {}", table, odbcerror(sql));
+
+	char index[256];
+	SQLLEN index_len = 0;
+	SQLBindCol(sql, 6, SQL_C_CHAR, index, sizeof(index), &index_len);
+
+	SQLRETURN r;
+	while (SQL_SUCCEEDED(r = SQLFetch(sql))) {
+		if (index_len == SQL_NULL_DATA || index_len == 0)
+			continue;
+		info.indexes.emplace(index, strnlen(index, sizeof(index)));
+	}
+	if (r != SQL_NO_DATA)
+		return _log.fail(EINVAL, "Failed to fetch indexes for '{}': {}", table, odbcerror(sql));
+	info.indexes_loaded = true;
+	return 0;
+}
+
+int ODBC::_check_table(std::string_view table, CatalogTable &info, const Prepared &prepared)
 {
+	_log.debug("Check table '{}' against catalog", table);
+	auto msg = prepared.message;
+
+	auto check = [&](std::string_view name, TypeClass expected) {
+		auto it = info.columns.find(name);
+		if (it == info.columns.end())
+			return _log.fail(EINVAL, "Table '{}' for '{}': column '{}' not found", table, msg->name, name);
+		auto actual = type_class(it->second);
+		if (!type_compatible(expected, actual))
+			return _log.fail(EINVAL, "Table '{}' for '{}': column '{}' has {} type {}, expected {}", table, msg->name,
+				name, type_class_name(actual), it->second, type_class_name(expected));
+		return 0;
+	};
+
+	if (prepared.with_seq && check("_tll_seq", TypeClass::Integer))
+		return EINVAL;
+	for (auto & c : prepared.convert) {
+		auto options = c.field->options;
+		if (c.field->type == tll::scheme::Field::Pointer)
+			options = c.field->type_ptr->options;
+		auto expected = type_class(c.field);
+		if (tll::getter::get(options, "sql.column-type"))
+			expected = TypeClass::Unknown; // Custom type, check only presence
+		if (check(c.field->name, expected))
+			return EINVAL;
+	}
+	if (prepared.storage == Prepared::Storage::Blob) {
+		auto expected = TypeClass::Binary;
+		if (tll::getter::get(msg->options, "sql.blob-type"))
+			expected = TypeClass::Unknown;
+		if (check("_tll_data", expected))
+			return EINVAL;
+	}
+
+	auto qualified = info.schema.size() && table.find('.') == table.npos ? fmt::format("{}.{}", info.schema, table) : std::string(table);
+	if (!info.indexes_loaded && _load_indexes(qualified, info))
+		return EINVAL;
+
+	for (auto & [key, unique] : _table_indexes(prepared)) {
+		auto name = fmt::format("_tll_{}_{}", table, key);
+		if (info.indexes.find(name) != info.indexes.end())
+			continue;
+		if (_create_index(table, key, unique))
+			return _log.fail(EINVAL, "Failed to create index {} for table {}", key, table);
+		info.indexes.insert(name);
+	}
+	return 0;
+}
+
+std::vector<std::pair<std::string_view, bool>> ODBC::_table_indexes(const Prepared &prepared)
+{
+	std::vector<std::pair<std::string_view, bool>> result;
+	auto msg = prepared.message;
+	{
+		auto index = tll::getter::getT(msg->options, "sql.index", _seq_index, {{"no", Index::No}, {"yes", Index::Yes}, {"unique", Index::Unique}});
+		if (!index) {
+			_log.warning("Invalid sql.index option for {}: {}", msg->name, index.error());
+		} else if (!prepared.with_seq) { // No seq field
+		} else if (*index != Index::No) {
+			result.emplace_back("_tll_seq", *index == Index::Unique);
+		}
+	}
+
+	for (auto & c : prepared.convert) {
+		auto & f = *c.field;
+		auto index = tll::getter::getT(f.options, "sql.index", Index::No, {{"no", Index::No}, {"yes", Index::Yes}, {"unique", Index::Unique}});
+		if (!index) {
+			_log.warning("Invalid sql.index option for {}.{}: {}", msg->name, f.name, index.error());
+		} else if (*index != Index::No) {
+			result.emplace_back(f.name, *index == Index::Unique);
+		}
+	}
+	return result;
+}
+
+int ODBC::_create_table(std::string_view table, const Prepared &prepared)
+{
+	if (_create_mode == Create::Checked) {
+		if (auto info = _catalog_find(table); info)
+			return _check_table(table, *info, prepared);
+	}
+
 	query_ptr_t sql;
+	auto msg = prepared.message;
+	auto row = prepared.row_message();
 
 	_log.info("Create table '{}'", table);
 	std::list<std::string> fields;
 
-	auto with_seq = tll::getter::getT(msg->options, "sql.with-seq", true);
-	if (!with_seq)
-		return _log.fail(EINVAL, "Invalid sql.with-seq option: {}", with_seq.error());
-	if (*with_seq)
+	if (prepared.with_seq)
 		fields.push_back(fmt::format("{} INTEGER", _quoted("_tll_seq")));
 
-	for (auto & f : tll::util::list_wrap(msg->fields)) {
-		if (&f == msg->pmap)
-			continue;
+	for (auto & c : prepared.convert) {
+		auto & f = *c.field;
 		auto options = f.options;
 		if (f.type == f.Pointer)
 			options = f.type_ptr->options;
@@ -680,7 +2139,7 @@ int ODBC::_create_table(std::string_view table, const tll::scheme::Message * msg
 
 		auto otype = tll::getter::get(options, "sql.column-type").value_or(*t);
 		std::string_view notnull = " NOT NULL";
-		if (msg->pmap && f.index >= 0)
+		if (row->pmap && f.index >= 0)
 			notnull = "";
 		fields.push_back(fmt::format("{} {}{}", _quoted(f.name), otype, notnull));
 
@@ -694,33 +2153,35 @@ int ODBC::_create_table(std::string_view table, const tll::scheme::Message * msg
 		}
 	}
 
-	sql = _prepare(fmt::format("CREATE TABLE {}{} ({})", _if_not_exists(), _quoted_table(table), join(fields.begin(), fields.end())));
+	if (prepared.storage == Prepared::Storage::Blob) {
+		auto type = tll::getter::get(msg->options, "sql.blob-type").value_or(_blob_type());
+		fields.push_back(fmt::format("{} {} NOT NULL", _quoted("_tll_data"), type));
+	}
+
+	sql = _prepare(fmt::format("CREATE TABLE {}{} ({})", _if_not_exists(), _quoted_table(table), join(fields.begin(), fields.end())), prepared.message->msgid);
 	if (!sql)
 		return _log.fail(EINVAL, "Failed to prepare CREATE statement");
 
 	if (auto r = SQLExecute(sql); r != SQL_SUCCESS && r != SQL_NO_DATA)
 		return _log.fail(EINVAL, "Failed to create table '{}': {}", table, odbcerror(sql));
 
-	{
-		auto index = tll::getter::getT(msg->options, "sql.index", _seq_index, {{"no", Index::No}, {"yes", Index::Yes}, {"unique", Index::Unique}});
-		if (!index) {
-			_log.warning("Invalid sql.index option for {}: {}", msg->name, index.error());
-		} else if (!*with_seq) { // No seq field
-		} else if (*index != Index::No) {
-			if (_create_index(table, "_tll_seq", *index == Index::Unique))
-				return _log.fail(EINVAL, "Failed to create seq index for table {}", table);
-		}
+	CatalogTable info;
+	info.indexes_loaded = true;
+	if (prepared.with_seq)
+		info.columns.emplace("_tll_seq", SQL_UNKNOWN_TYPE);
+	for (auto & c : prepared.convert)
+		info.columns.emplace(c.field->name, SQL_UNKNOWN_TYPE);
+	if (prepared.storage == Prepared::Storage::Blob)
+		info.columns.emplace("_tll_data", SQL_UNKNOWN_TYPE);
+
+	for (auto & [key, unique] : _table_indexes(prepared)) {
+		if (_create_index(table, key, unique))
+			return _log.fail(EINVAL, "Failed to create index {} for table {}", key, table);
+		info.indexes.insert(fmt::format("_tll_{}_{}", table, key));
 	}
 
-	for (auto & f : tll::util::list_wrap(msg->fields)) {
-		auto index = tll::getter::getT(f.options, "sql.index", Index::No, {{"no", Index::No}, {"yes", Index::Yes}, {"unique", Index::Unique}});
-		if (!index) {
-			_log.warning("Invalid sql.index option for {}.{}: {}", msg->name, f.name, index.error());
-		} else if (*index != Index::No) {
-			if (_create_index(table, f.name, *index == Index::Unique))
-				return _log.fail(EINVAL, "Failed to create index {} for table {}", f.name, table);
-		}
-	}
+	if (_create_mode == Create::Checked)
+		_catalog.emplace(table, std::move(info));
 
 	return 0;
 }
@@ -729,19 +2190,11 @@ int ODBC::_create_query(const tll::scheme::Message *msg)
 {
 	auto reader = tll::make_props_reader(msg->options);
 
-	auto table = reader.getT<std::string>("sql.table", msg->name);
-
-	std::list<std::string> names;
+	auto table = reader.getT<std::string>("sql.table", "");
 	auto with_seq = reader.getT("sql.with-seq", true);
-
-	if (with_seq)
-		names.push_back(_quoted("_tll_seq"));
-
-	for (auto & f : tll::util::list_wrap(msg->fields)) {
-		if (&f == msg->pmap)
-			continue;
-		names.push_back(_quoted(f.name));
-	}
+	auto storage = reader.getT("sql.storage", Prepared::Storage::Columns, {{"columns", Prepared::Storage::Columns}, {"blob", Prepared::Storage::Blob}});
+	auto partition = reader.getT("sql.partition", Prepared::Partition::None, {{"no", Prepared::Partition::None}, {"daily", Prepared::Partition::Daily}, {"hourly", Prepared::Partition::Hourly}});
+	auto partition_field = reader.getT("sql.partition-field", std::string());
 
 	auto tmpl = reader.getT("sql.template", _default_template);
 	auto query = reader.getT("sql.query", std::string());
@@ -751,6 +2204,10 @@ int ODBC::_create_query(const tll::scheme::Message *msg)
 		tmpl = Template::None;
 
 	auto create = reader.getT("sql.create", tmpl == Template::Insert);
+	auto cache = reader.getT("sql.cache", false);
+	auto rows = reader.getT("sql.rows", false);
+	auto retention = reader.getT("sql.retention", std::string());
+	auto retention_field = reader.getT("sql.retention-field", std::string());
 
 	if (!reader)
 		return _log.fail(EINVAL, "Failed to read SQL options from message '{}': {}", msg->name, reader.error());
@@ -762,15 +2219,133 @@ int ODBC::_create_query(const tll::scheme::Message *msg)
 			return _log.fail(EINVAL, "Output message '{}' for query '{}' not found", output, msg->name);
 	}
 
+	if (storage == Prepared::Storage::Blob && tmpl != Template::Insert && tmpl != Template::None)
+		return _log.fail(EINVAL, "Blob storage in '{}' can be used only with insert template", msg->name);
+
+	const tll::scheme::Field * partition_ptr = nullptr;
+	if (partition != Prepared::Partition::None) {
+		if (tmpl != Template::Insert)
+			return _log.fail(EINVAL, "Partitions in '{}' can be used only with insert template", msg->name);
+		if (partition_field.size()) {
+			for (auto & f : tll::util::list_wrap(msg->fields)) {
+				if (f.name == partition_field)
+					partition_ptr = &f;
+			}
+			if (!partition_ptr)
+				return _log.fail(EINVAL, "Partition field '{}' not found in '{}'", partition_field, msg->name);
+			if (partition_ptr->sub_type != tll::scheme::Field::TimePoint)
+				return _log.fail(EINVAL, "Partition field '{}' in '{}' is not time point", partition_field, msg->name);
+		}
+	}
+
+	const tll::scheme::Field * rows_ptr = nullptr;
+	auto source = msg;
+	if (rows) {
+		// Message is list of rows, columns are taken from row message
+		using tll::scheme::Field;
+		if (tmpl != Template::Insert || storage != Prepared::Storage::Columns || partition != Prepared::Partition::None)
+			return _log.fail(EINVAL, "Multi-row message '{}' can be used only with insert template and column storage", msg->name);
+		for (auto & f : tll::util::list_wrap(msg->fields)) {
+			if (&f == msg->pmap)
+				continue;
+			if (rows_ptr)
+				return _log.fail(EINVAL, "Multi-row message '{}' has more then one field", msg->name);
+			rows_ptr = &f;
+		}
+		if (!rows_ptr)
+			return _log.fail(EINVAL, "Multi-row message '{}' has no fields", msg->name);
+		if (rows_ptr->type == Field::Array && rows_ptr->type_array->type == Field::Message)
+			source = rows_ptr->type_array->type_msg;
+		else if (rows_ptr->type == Field::Pointer && rows_ptr->type_ptr->type == Field::Message)
+			source = rows_ptr->type_ptr->type_msg;
+		else
+			return _log.fail(EINVAL, "Field '{}' of multi-row message '{}' is not list of messages", rows_ptr->name, msg->name);
+	}
+
+	if (table.empty()) {
+		if (source == msg)
+			table = msg->name;
+		else
+			table = std::string(tll::getter::get(source->options, "sql.table").value_or(source->name));
+	}
+
+	Prepared::Retention::Mode retention_mode = Prepared::Retention::None;
+	long long retention_count = 0;
+	tll::duration retention_age = {};
+	const tll::scheme::Field * retention_ptr = nullptr;
+	if (retention.size()) {
+		if (tmpl != Template::Insert || partition != Prepared::Partition::None)
+			return _log.fail(EINVAL, "Retention in '{}' can be used only with insert template without partitions", msg->name);
+		if (!with_seq)
+			return _log.fail(EINVAL, "Retention in '{}' needs seq column", msg->name);
+		// Plain number is count of kept rows, otherwise it is age with time unit
+		if (isdigit(retention.back())) {
+			auto r = tll::conv::to_any<long long>(retention);
+			if (!r || *r <= 0)
+				return _log.fail(EINVAL, "Invalid retention count in '{}': {}", msg->name, retention);
+			retention_mode = Prepared::Retention::Count;
+			retention_count = *r;
+		} else {
+			auto r = tll::conv::to_any<tll::duration>(retention);
+			if (!r || r->count() <= 0)
+				return _log.fail(EINVAL, "Invalid retention age in '{}': {}", msg->name, retention);
+			if (retention_field.empty())
+				return _log.fail(EINVAL, "Retention by age in '{}' needs sql.retention-field option", msg->name);
+			for (auto & f : tll::util::list_wrap(source->fields)) {
+				if (f.name == retention_field)
+					retention_ptr = &f;
+			}
+			if (!retention_ptr)
+				return _log.fail(EINVAL, "Retention field '{}' not found in '{}'", retention_field, msg->name);
+			if (retention_ptr->sub_type != tll::scheme::Field::TimePoint)
+				return _log.fail(EINVAL, "Retention field '{}' in '{}' is not time point", retention_field, msg->name);
+			retention_mode = Prepared::Retention::Age;
+			retention_age = *r;
+		}
+	}
+
+	std::vector<const tll::scheme::Field *> columns;
+	for (auto & f : tll::util::list_wrap(source->fields)) {
+		if (&f == source->pmap)
+			continue;
+		if (auto r = field_storage(&f); !r)
+			return _log.fail(EINVAL, "Invalid sql.storage option for '{}.{}': {}", source->name, f.name, r.error());
+		if (auto r = tll::getter::getT(f.options, "sql.scale", 0u); !r || *r > 18)
+			return _log.fail(EINVAL, "Invalid sql.scale option for '{}.{}'", source->name, f.name);
+		if (rows) {
+			RowColumn col = { &f };
+			if (row_column(col))
+				return _log.fail(EINVAL, "Field '{}.{}' can not be used in multi-row insert", source->name, f.name);
+		}
+		if (storage == Prepared::Storage::Blob) {
+			// Only indexed fields are stored in separate columns, whole message is kept in _tll_data
+			auto index = tll::getter::getT(f.options, "sql.index", Index::No, {{"no", Index::No}, {"yes", Index::Yes}, {"unique", Index::Unique}});
+			if (!index || *index == Index::No)
+				continue;
+		}
+		columns.push_back(&f);
+	}
+
+	std::list<std::string> names;
+	if (with_seq)
+		names.push_back(_quoted("_tll_seq"));
+	for (auto f : columns)
+		names.push_back(_quoted(f->name));
+	if (storage == Prepared::Storage::Blob)
+		names.push_back(_quoted("_tll_data"));
+
+	std::string insert;
 	switch (tmpl) {
 	case Template::None:
 		break;
-	case Template::Insert:
-		query = fmt::format("INSERT INTO {}({}) VALUES ", _quoted_table(table), join(names.begin(), names.end()));
+	case Template::Insert: {
+		auto columns = join(names.begin(), names.end());
 		for (auto & i : names)
 			i = "?";
-		query += fmt::format("({})", join(names.begin(), names.end()));
+		insert = fmt::format("({}) VALUES ({})", columns, join(names.begin(), names.end()));
+		query = fmt::format("INSERT INTO {}{}", _quoted_table(table), insert);
 		break;
+	}
 	case Template::Function: {
 		if (!outmsg)
 			return _log.fail(EINVAL, "Function template '{}' without output message", msg->name);
@@ -796,269 +2371,2060 @@ int ODBC::_create_query(const tll::scheme::Message *msg)
 		break;
 	}
 
-	query_ptr_t sql;
+	auto it = _messages.emplace(msg->msgid, query_ptr_t {}).first;
+	auto & prepared = it->second;
+	prepared.message = msg;
+	prepared.output_message = outmsg;
+	prepared.with_seq = with_seq;
+	prepared.storage = storage;
+	prepared.table = table;
+	prepared.query = query;
+	prepared.cache = cache;
+	prepared.rows = rows_ptr;
+	prepared.convert.resize(columns.size());
+	for (auto i = 0u; i < columns.size(); i++)
+		_init_convert(prepared.convert[i], columns[i]);
+
+	if (partition != Prepared::Partition::None) {
+		// Tables are created and statements prepared per partition, next one is created ahead from timer
+		prepared.partition.mode = partition;
+		prepared.partition.field = partition_ptr;
+		prepared.partition.insert = insert;
+		prepared.partition.create = create && _create_mode != Create::No;
+
+		if (!_partition_timer) {
+			auto curl = child_url_parse("timer://;clock=monotonic", "partition");
+			if (!curl)
+				return _log.fail(EINVAL, "Failed to parse timer url: {}", curl.error());
+			curl->set("interval", fmt::format("{}", _partition_interval));
+			_partition_timer = context().channel(*curl);
+			if (!_partition_timer)
+				return _log.fail(EINVAL, "Failed to create partition timer channel");
+			_partition_timer->callback_add<ODBC, &ODBC::_on_partition>(this, TLL_MESSAGE_MASK_DATA);
+			_child_add(_partition_timer.get(), "partition");
+		}
+		if (_partition_timer->state() == tll::state::Closed) {
+			if (_partition_timer->open())
+				return _log.fail(EINVAL, "Failed to open partition timer");
+		}
+
+		// With partition field period is not known until first insert
+		if (partition_ptr)
+			return 0;
+		auto now = std::chrono::duration_cast<std::chrono::seconds>(tll::time::now().time_since_epoch());
+		if (_partition_switch(prepared, prepared.partition.period(now.count()))) {
+			_messages.erase(it);
+			return _log.fail(EINVAL, "Failed to prepare partition for '{}'", msg->name);
+		}
+		return 0;
+	}
+
 	if (query.size()) {
-		sql = _prepare(query);
-		if (!sql)
+		prepared.sql = _prepare(query, msg->msgid);
+		if (!prepared.sql) {
+			_messages.erase(it);
 			return _log.fail(EINVAL, "Failed to prepare insert statement for table {}: {}", table, query);
+		}
 	}
 
 	if (create && _create_mode != Create::No) {
-		if (_create_table(table, msg))
+		if (_create_table(table, prepared)) {
+			_messages.erase(it);
 			return _log.fail(EINVAL, "Failed to create table '{}' for '{}'", table, msg->name);
+		}
 	}
 
-	auto it = _messages.emplace(msg->msgid, std::move(sql)).first;
-	it->second.message = msg;
-	it->second.convert.resize(with_seq ? names.size() - 1 : names.size());
-	it->second.output_message = outmsg;
-	it->second.with_seq = with_seq;
-
+	if (retention_mode != Prepared::Retention::None) {
+		auto & r = prepared.retention;
+		r.mode = retention_mode;
+		r.count = retention_count;
+		r.age = retention_age;
+		if (retention_ptr) {
+			_init_convert(r.convert, retention_ptr);
+			r.value.resize(retention_ptr->size);
+		}
+		if (_retention_prepare(prepared)) {
+			_messages.erase(it);
+			return _log.fail(EINVAL, "Failed to prepare retention statement for '{}'", msg->name);
+		}
+	}
+
+	return 0;
+}
+
+int ODBC::_retention_prepare(Prepared &prepared)
+{
+	auto & r = prepared.retention;
+	auto seq = _quoted("_tll_seq");
+	auto table = _quoted_table(prepared.table);
+
+	std::string cond;
+	if (r.mode == Prepared::Retention::Count)
+		cond = fmt::format("{} <= (SELECT MAX({}) FROM {}) - {}", seq, seq, table, r.count);
+	else
+		cond = fmt::format("{} < ?", _quoted(r.convert.field->name));
+
+	// Rows are deleted in chunks ordered by indexed seq column to keep locks short. Chunk is selected
+	// through derived table: MySQL does not allow LIMIT in IN subquery or reading target table there
+	std::string query;
+	if (_quotes == Quotes::Sybase)
+		query = fmt::format("DELETE TOP ({}) FROM {} WHERE {}", _retention_chunk, table, cond);
+	else
+		query = fmt::format("DELETE FROM {} WHERE {} IN (SELECT {} FROM (SELECT {} FROM {} WHERE {} ORDER BY {} LIMIT {}) AS {})",
+			table, seq, seq, seq, table, cond, seq, _retention_chunk, _quoted("_tll_chunk"));
+
+	r.sql = _prepare(query, prepared.message->msgid);
+	if (!r.sql)
+		return _log.fail(EINVAL, "Failed to prepare retention statement: {}", query);
+
+	if (!_retention_timer) {
+		auto curl = child_url_parse("timer://;clock=monotonic", "retention");
+		if (!curl)
+			return _log.fail(EINVAL, "Failed to parse timer url: {}", curl.error());
+		curl->set("interval", fmt::format("{}", _retention_interval));
+		_retention_timer = context().channel(*curl);
+		if (!_retention_timer)
+			return _log.fail(EINVAL, "Failed to create retention timer channel");
+		_retention_timer->callback_add<ODBC, &ODBC::_on_retention>(this, TLL_MESSAGE_MASK_DATA);
+		_child_add(_retention_timer.get(), "retention");
+	}
+	if (_retention_timer->state() == tll::state::Closed) {
+		if (_retention_timer->open())
+			return _log.fail(EINVAL, "Failed to open retention timer");
+	}
+	return 0;
+}
+
+int ODBC::_on_retention(const tll::Channel *, const tll_msg_t *)
+{
+	// Same as writes purge waits for active query to finish
+	if (state() != tll::state::Active || _transaction || _select)
+		return 0;
+	for (auto & [_, m] : _messages) {
+		if (m.retention.mode == Prepared::Retention::None)
+			continue;
+		if (_retention_purge(m))
+			_log.warning("Retention purge failed for table {}", m.table);
+	}
+	return 0;
+}
+
+int ODBC::_retention_purge(Prepared &prepared)
+{
+	auto & r = prepared.retention;
+	if (r.mode == Prepared::Retention::Age) {
+		auto cutoff = std::chrono::duration_cast<std::chrono::nanoseconds>((tll::time::now() - r.age).time_since_epoch()).count();
+		time_store(r.convert.field, cutoff / 1000000000, cutoff % 1000000000, r.value.data());
+		r.convert.param = 0;
+		SQLFreeStmt(r.sql, SQL_RESET_PARAMS);
+		if (sql_bind(r.sql, r.convert, 1, tll::make_view(r.value)))
+			return _log.fail(EINVAL, "Failed to bind retention cutoff: {}", odbcerror(r.sql));
+	}
+
+	auto result = _execute(r.sql, "purge");
+	if (result == ENOENT) // Nothing to delete
+		return 0;
+	if (result)
+		return result;
+
+	SQLLEN count = 0;
+	SQLRowCount(r.sql, &count);
+	SQLFreeStmt(r.sql, SQL_CLOSE);
+	if (count > 0) {
+		_log.debug("Purged {} rows from {}", count, prepared.table);
+		if (_cache.size())
+			_cache_invalidate(prepared.table);
+	}
+	return 0;
+}
+
+void ODBC::_init_convert(Prepared::Convert &conv, const tll::scheme::Field * field)
+{
+	using tll::scheme::Field;
+	auto & f = *field;
+	conv.field = field;
+	if (f.type == Field::Pointer && f.type_ptr->type == Field::Int8 && f.sub_type == Field::ByteString) {
+		conv.type = Prepared::Convert::String;
+		conv.string = nullptr; // Points into output buffer tail, see _bind_columns
+		conv.string_size = _string_size;
+	} else if (f.type == Field::Bytes && f.sub_type == Field::ByteString) {
+		conv.type = Prepared::Convert::String;
+		conv.string_size = f.size + 1;
+		conv.bytestring_data.reset(new char[conv.string_size]);
+		conv.string = conv.bytestring_data.get();
+	} else if (f.type == Field::Decimal128) {
+		conv.type = Prepared::Convert::Numeric;
+		if (integer_storage(field)) {
+			conv.type = Prepared::Convert::Scaled;
+			conv.scale = tll::getter::getT(f.options, "sql.scale", 0u).value_or(0);
+		}
+	} else if (f.sub_type == Field::TimePoint) {
+		// Ticks in integer storage are bound directly
+		if (!integer_storage(field))
+			conv.type = Prepared::Convert::Timestamp;
+	}
+}
+
+std::string ODBC::_partition_table(const Prepared &prepared, long period)
+{
+	auto & part = prepared.partition;
+	time_t seconds = period * part.step();
+	struct tm tm;
+	if (!gmtime_r(&seconds, &tm))
+		return "";
+	char suffix[32];
+	strftime(suffix, sizeof(suffix), part.mode == Prepared::Partition::Daily ? "%Y%m%d" : "%Y%m%d%H", &tm);
+	return fmt::format("{}_{}", prepared.table, suffix);
+}
+
+query_ptr_t * ODBC::_partition(Prepared &prepared, long period)
+{
+	auto & part = prepared.partition;
+	if (auto it = part.tables.find(period); it != part.tables.end())
+		return &it->second;
+
+	auto table = _partition_table(prepared, period);
+	if (table.empty())
+		return _log.fail(nullptr, "Invalid partition period {}", period);
+
+	if (part.create && _create_table(table, prepared))
+		return _log.fail(nullptr, "Failed to create partition table '{}' for '{}'", table, prepared.message->name);
+
+	auto sql = _prepare(fmt::format("INSERT INTO {}{}", _quoted_table(table), part.insert), prepared.message->msgid);
+	if (!sql)
+		return _log.fail(nullptr, "Failed to prepare insert statement for partition {}", table);
+
+	// Keep only few recent statements, late messages for old partitions are rare
+	while (part.tables.size() >= 4 && part.tables.begin()->first < period)
+		part.tables.erase(part.tables.begin());
+	return &part.tables.emplace(period, std::move(sql)).first->second;
+}
+
+int ODBC::_partition_switch(Prepared &prepared, long period)
+{
+	auto & part = prepared.partition;
+	auto sql = _partition(prepared, period);
+	if (!sql)
+		return EINVAL;
+	prepared.sql = *sql;
+	part.query = fmt::format("INSERT INTO {}{}", _quoted_table(_partition_table(prepared, period)), part.insert);
+	part.active = period;
+	part.last = std::max(part.last, period);
+	return 0;
+}
+
+int ODBC::_on_partition(const tll::Channel *, const tll_msg_t *)
+{
+	if (state() != tll::state::Active || _transaction || _select)
+		return 0;
+	auto now = std::chrono::duration_cast<std::chrono::seconds>(tll::time::now().time_since_epoch()).count();
+	for (auto & [_, m] : _messages) {
+		auto & part = m.partition;
+		if (part.mode == Prepared::Partition::None)
+			continue;
+		// Create next partition ahead, switch on period boundary does not wait for CREATE TABLE
+		auto period = part.field ? part.last : std::max(part.last, part.period(now));
+		if (period < 0)
+			continue;
+		if (!_partition(m, period + 1))
+			_log.warning("Failed to prepare next partition for '{}'", m.message->name);
+	}
+	return 0;
+}
+
+int ODBC::_partition_tables(const Prepared &prepared, std::vector<std::pair<long, std::string>> &result)
+{
+	auto sql = _alloc();
+	if (!sql)
+		return EINVAL;
+
+	std::string_view schema, table = prepared.table;
+	if (auto dot = table.find('.'); dot != table.npos) {
+		schema = table.substr(0, dot);
+		table = table.substr(dot + 1);
+	}
+	auto prefix = fmt::format("{}_", table);
+	auto pattern = prefix + "%";
+	if (auto r = SQLTables(sql, nullptr, 0, schema.size() ? (SQLCHAR *) schema.data() : nullptr, schema.size(),
+				(SQLCHAR *) pattern.data(), pattern.size(), (SQLCHAR *) "TABLE", SQL_NTS); !SQL_SUCCEEDED(r))
+		return _log.fail(EINVAL, "Failed to list partitions of '{}': {}", prepared.table, odbcerror(sql));
+
+	char name[256];
+	SQLLEN len = 0;
+	if (auto r = SQLBindCol(sql, 3, SQL_C_CHAR, name, sizeof(name), &len); !SQL_SUCCEEDED(r))
+		return _log.fail(EINVAL, "Failed to bind table name column: {}", odbcerror(sql));
+
+	const size_t digits = prepared.partition.mode == Prepared::Partition::Daily ? 8 : 10;
+	while (SQL_SUCCEEDED(SQLFetch(sql))) {
+		std::string_view n(name, strnlen(name, sizeof(name)));
+		if (n.size() != prefix.size() + digits || n.substr(0, prefix.size()) != prefix)
+			continue;
+		auto suffix = n.substr(prefix.size());
+		if (std::find_if(suffix.begin(), suffix.end(), [](auto c) { return c < '0' || c > '9'; }) != suffix.end())
+			continue;
+		auto number = [&suffix](size_t off, size_t size) { return std::stoi(std::string(suffix.substr(off, size))); };
+		struct tm tm = {};
+		tm.tm_year = number(0, 4) - 1900;
+		tm.tm_mon = number(4, 2) - 1;
+		tm.tm_mday = number(6, 2);
+		if (digits == 10)
+			tm.tm_hour = number(8, 2);
+		auto period = prepared.partition.period(timegm(&tm));
+		if (schema.size())
+			result.emplace_back(period, fmt::format("{}.{}", schema, n));
+		else
+			result.emplace_back(period, std::string(n));
+	}
+	std::sort(result.begin(), result.end());
+	return 0;
+}
+
+int ODBC::_create_index(const std::string_view &name, std::string_view key, bool unique)
+{
+	if (_index_mode == IndexMode::Deferred) {
+		_log.debug("Defer index for {}: key {}", name, key);
+		_deferred_index.push_back({std::string(name), std::string(key), unique});
+		return 0;
+	}
+	return _build_index(name, key, unique);
+}
+
+int ODBC::_build_deferred_index()
+{
+	_log.info("Create {} deferred indexes", _deferred_index.size());
+	auto it = _deferred_index.begin();
+	for (; it != _deferred_index.end(); it++) {
+		if (_build_index(it->table, it->key, it->unique))
+			break;
+	}
+	_deferred_index.erase(_deferred_index.begin(), it);
+	if (_deferred_index.size())
+		return _log.fail(EINVAL, "Failed to create index for {}: key {}", _deferred_index.front().table, _deferred_index.front().key);
+	return 0;
+}
+
+int ODBC::_build_index(const std::string_view &name, std::string_view key, bool unique)
+{
+	_log.debug("Create index for {}: key {}", name, key);
+	query_ptr_t sql;
+
+	std::string_view ustr = unique ? "UNIQUE " : "";
+	auto str = fmt::format("CREATE {} INDEX {}{} on {}({})", ustr, _if_not_exists(), _quoted(fmt::format("_tll_{}_{}", name, key)), _quoted(name), _quoted(key));
+	sql = _prepare(str);
+	if (!sql)
+		return _log.fail(EINVAL, "Failed to prepare index statement: {}", str);
+
+	if (auto r = SQLExecute(sql); r != SQL_SUCCESS && r != SQL_NO_DATA)
+		return _log.fail(EINVAL, "Failed to create index for '{}': {}", name, key);
+	return 0;
+}
+
+int ODBC::_post(const tll_msg_t *msg, int flags)
+{
+	if (_shared_check())
+		return state_fail(EINVAL, "Shared connection is lost");
+	if (msg->type != TLL_MESSAGE_DATA) {
+		if (msg->type == TLL_MESSAGE_CONTROL)
+			return _post_control(msg, flags);
+		return 0;
+	}
+
+	if (_select)
+		return _log.fail(EINVAL, "Previous query is not finished, can not write data");
+
+	if (msg->msgid == 0)
+		return _log.fail(EINVAL, "Unable to insert message without msgid");
+	auto ptr = _lookup(msg->msgid);
+	if (!ptr) {
+		if (!_strict && _prepare_failed.count(msg->msgid))
+			return 0;
+		return _log.fail(ENOENT, "Message {} not found", msg->msgid);
+	}
+
+	// Journal is flushed on Begin, messages inside transaction are written directly so Rollback discards them
+	if (!_journal.is_open() || _transaction)
+		return _insert(*ptr, msg);
+
+	if (ptr->output) {
+		// Function results may depend on spilled data, write everything before calling it
+		if (auto r = _spill_flush(); r)
+			return r;
+		return _insert(*ptr, msg);
+	}
+
+	if (_spill_active || !_journal.empty())
+		return _spill_push(msg);
+
+	auto start = std::chrono::steady_clock::now();
+	if (auto r = _insert(*ptr, msg); r)
+		return r;
+	auto latency = std::chrono::duration_cast<tll::duration>(std::chrono::steady_clock::now() - start);
+	if (latency > _spill_latency) {
+		_log.warning("Insert latency {} exceeds spill threshold {}, write messages to journal", latency, _spill_latency);
+		_spill_active = true;
+	}
+	return 0;
+}
+
+int ODBC::_insert(Prepared &insert, const tll_msg_t *msg)
+{
+	if (insert.partition.mode != Prepared::Partition::None) {
+		auto & part = insert.partition;
+		time_t seconds = 0;
+		if (part.field) {
+			if (msg->size < part.field->offset + part.field->size)
+				return _log.fail(EMSGSIZE, "Message {} size {} is too small for partition field", insert.message->name, msg->size);
+			seconds = time_seconds(part.field, static_cast<const char *>(msg->data) + part.field->offset);
+		} else
+			seconds = std::chrono::duration_cast<std::chrono::seconds>(tll::time::now().time_since_epoch()).count();
+		if (auto period = part.period(seconds); period != part.active) {
+			if (_partition_switch(insert, period))
+				return _log.fail(EINVAL, "Failed to switch partition for {}", insert.message->name);
+		}
+	}
+
+	if (!insert.sql) {
+		_log.trace("Skip message {} without SQL statement", insert.message->name);
+		return 0;
+	}
+
+	if (insert.with_seq) {
+		// Rows of multi-row message take seq values after its own one, posting them again would violate unique index
+		if (auto it = _rows_seq.find(insert.table); it != _rows_seq.end() && it->second.first < msg->seq && msg->seq <= it->second.second)
+			return _log.fail(EINVAL, "Seq {} of {} is used by rows of multi-row message with seq {}, next free seq is {}",
+					msg->seq, insert.message->name, it->second.first, it->second.second + 1);
+	}
+
+	if (insert.rows)
+		return _insert_rows(insert, msg);
+
+	SQLFreeStmt(insert.sql, SQL_RESET_PARAMS);
+
+	auto view = tll::make_view(*msg);
+
+	ODBC_PROBE(bind_start, msg->msgid, msg->seq, 1, 0);
+	int idx = 1;
+	if (insert.with_seq) {
+		if (auto r = SQLBindParam(insert.sql, idx++, SQL_C_SBIGINT, SQL_BIGINT, 0, 0, (SQLPOINTER) &msg->seq, &_seq_param); !SQL_SUCCEEDED(r))
+			return _log.fail(EINVAL, "Failed to bind seq: {}", odbcerror(insert.sql));
+	}
+	auto pmap = insert.message->pmap;
+	for (auto & c : insert.convert) {
+		if (pmap && c.field->index >= 0) {
+			if (tll_scheme_pmap_get(view.view(pmap->offset).data(), c.field->index))
+				c.param = 0;
+			else
+				c.param = SQL_NULL_DATA;
+		}
+		if (sql_bind(insert.sql, c, idx++, view.view(c.field->offset)))
+			return _log.fail(EINVAL, "Failed to bind field {}: {}", c.field->name, odbcerror(insert.sql));
+	}
+	if (insert.storage == Prepared::Storage::Blob) {
+		insert.data_param = msg->size;
+		auto data = msg->size ? msg->data : "";
+		if (auto r = SQLBindParam(insert.sql, idx++, SQL_C_BINARY, SQL_VARBINARY, std::max<size_t>(msg->size, 1), 0, (SQLPOINTER) data, &insert.data_param); !SQL_SUCCEEDED(r))
+			return _log.fail(EINVAL, "Failed to bind message data: {}", odbcerror(insert.sql));
+	}
+	ODBC_PROBE(bind_done, msg->msgid, msg->seq, 1, 0);
+
+	auto start = _slow_start();
+	auto r = _execute(insert.sql, "insert", msg->msgid, msg->seq, 1);
+	_slow_check(start, "insert", insert, insert.statement(), msg->seq, [&insert, msg]() { return render_params(insert.convert, msg); });
+	if (!r || r == ENOENT)
+		_written(msg->seq);
+	if (r) {
+		if (r == ENOENT) {
+			if (!insert.output)
+				return 0;
+			_end_of_data();
+			return 0;
+		}
+		return r;
+	}
+
+	if (_cache.size())
+		_cache_invalidate(insert.table);
+
+	if (!insert.output) {
+		SQLCloseCursor(insert.sql);
+		return 0;
+	}
+
+	{
+		_cache_fill.reset();
+		_batch_rows.clear();
+		_select_sql = insert.sql;
+		_select = insert.output;
+		_select_query = insert.query;
+
+		if (auto r = _bind_columns(_select_sql, _select); r)
+			return r;
+
+		if (_spool)
+			return _spool_fill();
+		_update_dcaps(dcaps::Process | dcaps::Pending);
+	}
+	return 0;
+}
+
+int ODBC::_insert_rows(Prepared &insert, const tll_msg_t *msg)
+{
+	using tll::scheme::Field;
+	auto view = tll::make_view(*msg);
+	auto field = insert.rows;
+	auto row = insert.row_message();
+
+	// Locate list elements
+	size_t count = 0, entity = 0, offset = 0;
+	if (field->type == Field::Array) {
+		if (msg->size < field->offset + field->size)
+			return _log.fail(EMSGSIZE, "Message {} size {} is too small for array {}", insert.message->name, msg->size, field->name);
+		auto size = tll::scheme::read_size(field->count_ptr, view.view(field->count_ptr->offset));
+		if (size < 0 || (size_t) size > field->count)
+			return _log.fail(EINVAL, "Invalid array size {} in {}", size, insert.message->name);
+		count = size;
+		entity = field->type_array->size;
+		offset = field->type_array->offset;
+	} else {
+		auto ptr = tll::scheme::read_pointer(field, view.view(field->offset));
+		if (!ptr)
+			return _log.fail(EINVAL, "Failed to read list {} in {}", field->name, insert.message->name);
+		count = ptr->size;
+		entity = ptr->entity;
+		offset = field->offset + ptr->offset;
+		if (count && (entity < row->size || msg->size < offset + count * entity))
+			return _log.fail(EMSGSIZE, "List {} in {} is out of bounds", field->name, insert.message->name);
+	}
+	if (count == 0)
+		return 0;
+	auto data = view.view(offset);
+
+	// Layout of parameter array row: value slot and indicator for each column
+	auto align = [](size_t v) { return (v + 7) & ~size_t(7); };
+	std::vector<RowColumn> columns;
+	if (insert.with_seq)
+		columns.emplace_back();
+	for (auto & c : insert.convert) {
+		auto & col = columns.emplace_back();
+		col.field = c.field;
+		row_column(col);
+		if (c.field->type == Field::Pointer) {
+			for (auto i = 0u; i < count; i++) {
+				auto ptr = tll::scheme::read_pointer(c.field, data.view(i * entity + c.field->offset));
+				if (ptr)
+					col.size = std::max<size_t>(col.size, ptr->size);
+			}
+		}
+	}
+	size_t stride = 0;
+	for (auto & col : columns) {
+		col.offset = stride;
+		col.indicator = align(stride + col.size);
+		stride = col.indicator + sizeof(SQLLEN);
+	}
+
+	ODBC_PROBE(bind_start, msg->msgid, msg->seq, count, 0);
+	_rows_buf.resize(stride * count);
+	for (auto i = 0u; i < count; i++) {
+		auto buf = _rows_buf.data() + stride * i;
+		auto rview = data.view(i * entity);
+		for (auto & col : columns) {
+			auto & indicator = *reinterpret_cast<SQLLEN *>(buf + col.indicator);
+			if (!col.field) {
+				*reinterpret_cast<int64_t *>(buf + col.offset) = msg->seq + i;
+				indicator = 0;
+				continue;
+			}
+			if (row->pmap && col.field->index >= 0 && !tll_scheme_pmap_get(rview.view(row->pmap->offset).data(), col.field->index)) {
+				indicator = SQL_NULL_DATA;
+				continue;
+			}
+			if (auto r = row_value(col, rview.view(col.field->offset), buf + col.offset, indicator); r)
+				return _log.fail(EINVAL, "Failed to convert field {} of row {} in {}", col.field->name, i, insert.message->name);
+		}
+	}
+
+	SQLFreeStmt(insert.sql, SQL_RESET_PARAMS);
+	SQLSetStmtAttr(insert.sql, SQL_ATTR_PARAM_BIND_TYPE, (SQLPOINTER) stride, 0);
+	if (auto r = SQLSetStmtAttr(insert.sql, SQL_ATTR_PARAMSET_SIZE, (SQLPOINTER) count, 0); !SQL_SUCCEEDED(r))
+		return _log.fail(EINVAL, "Failed to set parameter array size {}: {}", count, odbcerror(insert.sql));
+	// Statement succeeds with info when only some rows fail, status is left untouched if driver does not fill it
+	_rows_status.assign(count, SQL_PARAM_SUCCESS);
+	SQLSetStmtAttr(insert.sql, SQL_ATTR_PARAM_STATUS_PTR, (SQLPOINTER) _rows_status.data(), 0);
+
+	int idx = 1;
+	for (auto & col : columns) {
+		auto size = col.ctype == SQL_C_CHAR ? std::max<size_t>(col.size - 1, 1) : 0; // Zero column size is invalid
+		auto buf = _rows_buf.data();
+		if (auto r = SQLBindParameter(insert.sql, idx, SQL_PARAM_INPUT, col.ctype, col.sqltype, size, 0, buf + col.offset, col.size, (SQLLEN *) (buf + col.indicator)); !SQL_SUCCEEDED(r))
+			return _log.fail(EINVAL, "Failed to bind column {}: {}", col.field ? col.field->name : "_tll_seq", odbcerror(insert.sql));
+		idx++;
+	}
+	ODBC_PROBE(bind_done, msg->msgid, msg->seq, count, 0);
+
+	auto start = _slow_start();
+	auto r = _execute(insert.sql, "insert", msg->msgid, msg->seq, count);
+	_slow_check(start, "insert", insert, insert.statement(), msg->seq, [count]() { return fmt::format("rows={}", count); });
+	if (r && r != ENOENT)
+		return r;
+	if (!r) {
+		size_t failed = 0;
+		for (auto i = 0u; i < count; i++) {
+			if (_rows_status[i] != SQL_PARAM_ERROR)
+				continue;
+			if (failed++ == 0)
+				_log.error("Failed to insert row {} of {}, seq {}: {}", i, insert.message->name, msg->seq + i, odbcerror(insert.sql));
+		}
+		if (failed) {
+			SQLCloseCursor(insert.sql);
+			return _log.fail(EINVAL, "Failed to insert {} of {} rows of {}, seq {}", failed, count, insert.message->name, msg->seq);
+		}
+	}
+	_written(msg->seq + count - 1);
+	if (insert.with_seq && count > 1)
+		_rows_seq[insert.table] = { msg->seq, msg->seq + count - 1 };
+
+	if (_cache.size())
+		_cache_invalidate(insert.table);
+	SQLCloseCursor(insert.sql);
+	return 0;
+}
+
+int ODBC::_spill_push(const tll_msg_t *msg)
+{
+	while (true) {
+		auto r = _journal.push(msg);
+		if (r == 0)
+			break;
+		if (r != ENOSPC)
+			return _log.fail(r, "Failed to write message to spill journal: {}", strerror(r));
+		if (_journal.empty()) {
+			_log.warning("Message {} of size {} does not fit into spill journal, insert directly", msg->msgid, msg->size);
+			auto ptr = _lookup(msg->msgid);
+			if (!ptr)
+				return _log.fail(ENOENT, "Message {} not found", msg->msgid);
+			return _insert(*ptr, msg);
+		}
+		_log.debug("Spill journal is full, write pending messages");
+		if (auto r = _spill_drain(64); r)
+			return r;
+	}
+	_update_pending();
+	return 0;
+}
+
+int ODBC::_spill_drain(size_t count)
+{
+	tll_msg_t msg = {};
+	for (; count && _journal.front(msg) == 0; count--) {
+		auto ptr = _lookup(msg.msgid);
+		if (!ptr) {
+			_log.error("Drop spilled message {}: not found in scheme", msg.msgid);
+			_journal.pop();
+			continue;
+		}
+		if (auto r = _insert(*ptr, &msg); r) {
+			if (state() == tll::state::Error) // Connection is lost, record is kept for next run
+				return _log.fail(r, "Failed to write spilled message {}, seq {}", ptr->message->name, msg.seq);
+			// Record that can not be written is dropped, otherwise it blocks journal forever
+			_log.error("Drop spilled message {} ({}), seq {}: insert failed", ptr->message->name, msg.msgid, msg.seq);
+		}
+		_journal.pop();
+	}
+
+	if (_journal.empty() && _spill_active) {
+		_log.info("Spill journal is empty, switch to direct writes");
+		_spill_active = false;
+	}
+	_update_pending();
 	return 0;
 }
 
-int ODBC::_create_index(const std::string_view &name, std::string_view key, bool unique)
-{
-	_log.debug("Create index for {}: key {}", name, key);
-	query_ptr_t sql;
+void ODBC::_update_pending()
+{
+	if (_select || !_journal.empty())
+		_update_dcaps(dcaps::Process | dcaps::Pending);
+	else
+		_update_dcaps(0, dcaps::Process | dcaps::Pending);
+}
+
+int ODBC::_execute(query_ptr_t &query, std::string_view message, int msgid, long long seq, size_t rows)
+{
+	ODBC_PROBE(execute_start, msgid, seq, rows, 0);
+	auto r = SQLExecute(query);
+	ODBC_PROBE(execute_done, msgid, seq, rows, r);
+	if (!SQL_SUCCEEDED(r)) {
+		auto error = odbcerror(query);
+		if (_sqlstate == "08S01") { // Fatal connection error
+			_connection_lost();
+			return state_fail(EINVAL, "Failed to {} data: {}", message, error);
+		}
+		if (r == SQL_NO_DATA) {
+			_log.debug("Query returned no data (SQL_NO_DATA)");
+			return ENOENT;
+		}
+		if (_timeout_state()) {
+			_log.warning("Failed to {} data, timed out: {}", message, error);
+			return ETIMEDOUT;
+		}
+		if (r == SQL_NEED_DATA)
+			return _log.fail(EINVAL, "Failed to {}: SQL_NEED_DATA: {}", message, error);
+		return _log.fail(EINVAL, "Failed to {} data: {}", message, error);
+	}
+	return 0;
+}
+
+int ODBC::_bind_columns(query_ptr_t &sql, Prepared * select, std::vector<char> &buf, long long &seq, SQLLEN &seq_param)
+{
+	// Variable length strings are fetched directly into the tail of output buffer, each column gets
+	// its own slot that is compacted after fetch. Buffer is never resized while columns are bound.
+	size_t size = select->message->size;
+	for (auto & c : select->convert) {
+		if (c.type == Prepared::Convert::String && c.field->type == tll::scheme::Field::Pointer)
+			size += c.string_size;
+	}
+	if (select->storage == Prepared::Storage::Blob) // Initial size, grows in _fetch_blob
+		size = std::max<size_t>(size, _string_size);
+	buf.clear();
+	buf.resize(size);
+
+	auto view = tll::make_view(buf);
+	auto tail = select->message->size;
+
+	int idx = 1;
+	if (select->with_seq) {
+		if (auto r = SQLBindCol(sql, idx++, SQL_C_SBIGINT, &seq, sizeof(seq), &seq_param); !SQL_SUCCEEDED(r))
+			return _log.fail(EINVAL, "Failed to bind seq column: {}", odbcerror(sql));
+	}
+	if (select->storage == Prepared::Storage::Blob) // Message body is fetched with SQLGetData
+		return 0;
+	for (auto & c : select->convert) {
+		_log.debug("Bind field {} at {}", c.field->name, c.field->offset);
+		if (c.type == Prepared::Convert::String && c.field->type == tll::scheme::Field::Pointer) {
+			c.string = buf.data() + tail;
+			tail += c.string_size;
+		}
+		if (sql_column(sql, c, idx++, c.field, view.view(c.field->offset)))
+			return _log.fail(EINVAL, "Failed to bind field {} column: {}", c.field->name, odbcerror(sql));
+	}
+	return 0;
+}
+
+int ODBC::_fetch_blob(query_ptr_t &sql, int idx, size_t &size)
+{
+	size = 0;
+	while (true) {
+		auto chunk = _buf.size() - size;
+		SQLLEN len = 0;
+		auto r = SQLGetData(sql, idx, SQL_C_BINARY, _buf.data() + size, chunk, &len);
+		if (r == SQL_NO_DATA) // Everything was fetched on previous call
+			return 0;
+		if (!SQL_SUCCEEDED(r))
+			return _log.fail(EINVAL, "Failed to get message data: {}", odbcerror(sql));
+		if (len == SQL_NULL_DATA)
+			return _log.fail(EINVAL, "Message data is NULL");
+		if (len != SQL_NO_TOTAL && (size_t) len <= chunk) {
+			size += len;
+			return 0;
+		}
+		// Data is truncated, len is size of remaining data including current chunk
+		size += chunk;
+		if (len == SQL_NO_TOTAL)
+			_buf.resize(2 * _buf.size());
+		else
+			_buf.resize(size + len - chunk);
+	}
+}
+
+namespace {
+std::string_view operator_to_string(odbc_scheme::Expression::Operator op)
+{
+	using O = odbc_scheme::Expression::Operator;
+	switch (op) {
+	case O::EQ: return "=";
+	case O::NE: return "!=";
+	case O::LT: return "<";
+	case O::LE: return "<=";
+	case O::GT: return ">";
+	case O::GE: return ">=";
+	case O::IN: return "IN";
+	}
+	return "UNKNOWN-OPERATOR";
+}
+
+const Prepared::Convert * lookup(const std::vector<Prepared::Convert> &list, std::string_view id)
+{
+	for (auto & c : list) {
+		if (c.field->name == id)
+			return &c;
+	}
+	return nullptr;
+}
+
+SQLRETURN sql_bind(SQLHSTMT sql, std::vector<Parameter> &params, int idx)
+{
+	for (auto & p : params) {
+		p.param = p.ctype == SQL_C_CHAR ? p.string.size() : 0;
+		if (auto r = SQLBindParam(sql, idx++, p.ctype, p.sqltype, 0, 0, p.data(), &p.param); !SQL_SUCCEEDED(r))
+			return r;
+	}
+	return SQL_SUCCESS;
+}
+
+template <typename View>
+std::string render_field(const tll::scheme::Field * field, const View &data)
+{
+	using tll::scheme::Field;
+	switch (field->type) {
+	case Field::Int8: return fmt::format("{}", *data.template dataT<int8_t>());
+	case Field::Int16: return fmt::format("{}", *data.template dataT<int16_t>());
+	case Field::Int32: return fmt::format("{}", *data.template dataT<int32_t>());
+	case Field::Int64: return fmt::format("{}", *data.template dataT<int64_t>());
+	case Field::UInt8: return fmt::format("{}", *data.template dataT<uint8_t>());
+	case Field::UInt16: return fmt::format("{}", *data.template dataT<uint16_t>());
+	case Field::UInt32: return fmt::format("{}", *data.template dataT<uint32_t>());
+	case Field::UInt64: return fmt::format("{}", *data.template dataT<uint64_t>());
+	case Field::Double: return fmt::format("{}", *data.template dataT<double>());
+	case Field::Decimal128: return tll::conv::to_string(*data.template dataT<tll::util::Decimal128>());
+	case Field::Bytes:
+		if (field->sub_type == Field::ByteString) {
+			auto str = data.template dataT<char>();
+			return fmt::format("'{}'", std::string_view(str, strnlen(str, field->size)));
+		}
+		break;
+	case Field::Pointer:
+		if (field->type_ptr->type == Field::Int8 && field->sub_type == Field::ByteString) {
+			auto ptr = tll::scheme::read_pointer(field, data);
+			if (!ptr || ptr->size == 0)
+				return "''";
+			return fmt::format("'{}'", std::string_view(data.view(ptr->offset).template dataT<char>(), ptr->size - 1));
+		}
+		break;
+	default:
+		break;
+	}
+	return "?";
+}
+
+std::string render_params(const std::vector<Prepared::Convert> &convert, const tll_msg_t *msg)
+{
+	auto view = tll::make_view(*msg);
+	std::list<std::string> r;
+	for (auto & c : convert) {
+		if (c.param == SQL_NULL_DATA)
+			r.push_back(fmt::format("{}=NULL", c.field->name));
+		else
+			r.push_back(fmt::format("{}={}", c.field->name, render_field(c.field, view.view(c.field->offset))));
+	}
+	return join(r.begin(), r.end());
+}
+
+// Type of list element in columnar batch message, empty if field can not be stored in column
+std::string batch_type(const tll::scheme::Field * field)
+{
+	using tll::scheme::Field;
+	switch (field->type) {
+	case Field::Int8: return "int8";
+	case Field::Int16: return "int16";
+	case Field::Int32: return "int32";
+	case Field::Int64: return "int64";
+	case Field::UInt8: return "uint8";
+	case Field::UInt16: return "uint16";
+	case Field::UInt32: return "uint32";
+	case Field::UInt64: return "uint64";
+	case Field::Double: return "double";
+	case Field::Decimal128: return "decimal128";
+	case Field::Bytes:
+		if (field->size < 255) // List entity size is limited
+			return fmt::format("byte{}", field->size);
+		break;
+	case Field::Pointer:
+		if (field->type_ptr->type == Field::Int8 && field->sub_type == Field::ByteString)
+			return "string";
+		break;
+	default:
+		break;
+	}
+	return "";
+}
+
+std::string render_params(const std::vector<Parameter> &params)
+{
+	std::list<std::string> r;
+	for (auto & p : params) {
+		switch (p.ctype) {
+		case SQL_C_CHAR: r.push_back(fmt::format("'{}'", p.string)); break;
+		case SQL_C_DOUBLE: r.push_back(fmt::format("{}", p.real)); break;
+		default: r.push_back(fmt::format("{}", p.integer)); break;
+		}
+	}
+	return join(r.begin(), r.end());
+}
+}
+
+int ODBC::_check_query(const tll_msg_t *msg)
+{
+	// Expression entries are 26 bytes since IN list was added, clients with older scheme send 18 byte entries
+	auto data = static_cast<const char *>(msg->data);
+	if (msg->size < odbc_scheme::Query::meta_size())
+		return _log.fail(EMSGSIZE, "Query message size {} is less than {}", msg->size, odbc_scheme::Query::meta_size());
+	auto list = reinterpret_cast<const tll_scheme_offset_ptr_t *>(data + 4);
+	if (!list->size)
+		return 0;
+	if (list->entity != odbc_scheme::Expression::meta_size())
+		return _log.fail(EINVAL, "Query expression entity size {} does not match {}, client uses incompatible control scheme",
+				(unsigned) list->entity, odbc_scheme::Expression::meta_size());
+	auto base = 4 + size_t(list->offset);
+	if (base + size_t(list->size) * list->entity > msg->size)
+		return _log.fail(EMSGSIZE, "Query expression list out of bounds: offset {} + {} entries, message size {}", base, (unsigned) list->size, msg->size);
+	constexpr size_t any_size = 9;
+	for (size_t i = 0; i < list->size; i++) {
+		auto off = base + i * list->entity + 18;
+		auto values = reinterpret_cast<const tll_scheme_offset_ptr_t *>(data + off);
+		if (!values->size)
+			continue;
+		if (values->entity != any_size)
+			return _log.fail(EINVAL, "Query expression {} value entity size {} does not match {}", i, (unsigned) values->entity, any_size);
+		if (off + values->offset + size_t(values->size) * values->entity > msg->size)
+			return _log.fail(EMSGSIZE, "Query expression {} value list out of bounds", i);
+	}
+	return 0;
+}
+
+int ODBC::_post_control(const tll_msg_t *msg, int flags)
+{
+	if (msg->msgid == odbc_scheme::Ping::meta_id())
+		return _ping(msg);
+	if (msg->msgid == odbc_scheme::SlowDump::meta_id())
+		return _slow_dump();
+	if (msg->msgid == odbc_scheme::Cancel::meta_id())
+		return _cancel();
+	if (msg->msgid == odbc_scheme::CreateIndex::meta_id()) {
+		if (_select)
+			return _log.fail(EINVAL, "Previous query is not finished, can not create indexes");
+		return _build_deferred_index();
+	}
+
+	if (msg->msgid == odbc_scheme::Begin::meta_id())
+		return _begin();
+	if (msg->msgid == odbc_scheme::Commit::meta_id())
+		return _end_transaction(SQL_COMMIT);
+	if (msg->msgid == odbc_scheme::Rollback::meta_id())
+		return _end_transaction(SQL_ROLLBACK);
+
+	if (internal.caps & tll::caps::Output) // Write-only channel
+		return 0;
+
+	if (msg->msgid == odbc_scheme::MergeQuery::meta_id())
+		return _merge_query(msg);
+	if (msg->msgid != odbc_scheme::Query::meta_id())
+		return _log.fail(EINVAL, "Invalid control message id: {}", msg->msgid);
+	if (_select)
+		return _log.fail(EINVAL, "Previous query is not finished, can not start new");
+	if (auto r = _spill_flush(); r)
+		return r;
+
+	if (auto r = _check_query(msg); r)
+		return r;
+	auto query = odbc_scheme::Query::bind(*msg);
+
+	auto ptr = _lookup(query.get_message());
+	if (!ptr)
+		return _log.fail(ENOENT, "Message {} not found in scheme", query.get_message());
+	auto & select = *ptr;
+	if (select.rows)
+		return _log.fail(EINVAL, "Multi-row message {} can not be queried, use row message", select.message->name);
+
+	std::list<std::string> names;
+	if (select.with_seq)
+		names.push_back(_quoted("_tll_seq"));
+	if (select.storage == Prepared::Storage::Blob) {
+		names.push_back(_quoted("_tll_data"));
+	} else {
+		for (auto & c : select.convert)
+			names.push_back(_quoted(c.field->name));
+	}
+	std::list<std::string> where;
+	std::vector<Parameter> params;
+	auto key = fmt::format("{}", select.message->msgid);
+	for (auto & e : query.get_expression()) {
+		if (!lookup(select.convert, e.get_field()))
+			return _log.fail(ENOENT, "No such column '{}' in message {}", e.get_field(), select.message->name);
+		if (e.get_op() == odbc_scheme::Expression::Operator::IN) {
+			auto list = e.get_list();
+			if (list.size() == 0) {
+				where.push_back("1 = 0");
+				key += fmt::format("\n{}\n{}", e.get_field(), (int) e.get_op());
+				continue;
+			}
+			// Number of placeholders is rounded up to power of two so statements have few distinct shapes
+			size_t arity = 1;
+			while (arity < list.size())
+				arity *= 2;
+			std::vector<std::string_view> marks(arity, "?");
+			where.push_back(fmt::format("{} IN ({})", _quoted(e.get_field()), join(marks.begin(), marks.end())));
+			_log.debug("Bind expression field {} ({}) with {} values", e.get_field(), params.size() + 1, list.size());
+			key += fmt::format("\n{}\n{}", e.get_field(), (int) e.get_op());
+			for (auto v : list) {
+				auto & p = params.emplace_back(v);
+				key += fmt::format(" {} {} {} {}:{}", p.ctype, p.integer, p.real, p.string.size(), p.string);
+			}
+			for (auto i = list.size(); i < arity; i++) // Padded with last value
+				params.push_back(params.back());
+			continue;
+		}
+		where.push_back(fmt::format("{} {} ?", _quoted(e.get_field()), operator_to_string(e.get_op())));
+		_log.debug("Bind expression field {} ({})", e.get_field(), params.size() + 1);
+		auto & p = params.emplace_back(e.get_value());
+		key += fmt::format("\n{}\n{} {} {} {} {}:{}", e.get_field(), (int) e.get_op(), p.ctype, p.integer, p.real, p.string.size(), p.string);
+	}
+	if (params.size() > _max_params)
+		return _log.fail(E2BIG, "Query for {} needs {} parameters (IN lists are padded to power of two), limit is {}",
+				select.message->name, params.size(), _max_params);
+
+	_cache_fill.reset();
+	_batch_rows.clear();
+	if (select.cache) {
+		_cache_key = std::move(key);
+		if (_cache_lookup(select))
+			return 0;
+		_cache_fill.reset(new Fetcher::Block);
+		_cache_table = select.table;
+	}
+
+	if (_parallel > 1 && _transaction) {
+		// Pooled connections do not see rows written in open transaction
+		_log.debug("Parallel read is not possible in transaction, use single cursor");
+	} else if (_parallel > 1) {
+		if (select.with_seq && select.partition.mode == Prepared::Partition::None && select.storage == Prepared::Storage::Columns) {
+			auto r = _query_parallel(select, join(names.begin(), names.end()), where, params);
+			if (r)
+				_fetch_stop();
+			return r;
+		}
+		_log.debug("Parallel read is not possible for '{}', use single cursor", select.message->name);
+	}
+
+	std::vector<std::string> tables;
+	if (select.partition.mode != Prepared::Partition::None) {
+		std::vector<std::pair<long, std::string>> list;
+		if (_partition_tables(select, list))
+			return _log.fail(EINVAL, "Failed to get partitions for '{}'", select.message->name);
+
+		// Partitions outside of time range given by expressions on partition field are not read,
+		// numeric values are raw field values in its resolution
+		auto lo = std::numeric_limits<long>::min(), hi = std::numeric_limits<long>::max();
+		if (auto field = select.partition.field; field) {
+			auto period = [&select, field](auto & v) -> std::optional<long> {
+				using Value = std::decay_t<decltype(v)>;
+				if (v.union_type() == Value::index_i) {
+					int64_t i = v.unchecked_i();
+					return select.partition.period(time_seconds(field, &i));
+				} else if (v.union_type() == Value::index_f) {
+					double f = v.unchecked_f();
+					return select.partition.period(time_seconds(field, &f));
+				}
+				return std::nullopt;
+			};
+			for (auto & e : query.get_expression()) {
+				if (e.get_field() != field->name)
+					continue;
+				using Op = odbc_scheme::Expression::Operator;
+				auto op = e.get_op();
+				if (op == Op::IN) {
+					std::optional<long> min, max;
+					for (auto v : e.get_list()) {
+						auto p = period(v);
+						if (!p) {
+							min = max = std::nullopt;
+							break;
+						}
+						min = std::min(min.value_or(*p), *p);
+						max = std::max(max.value_or(*p), *p);
+					}
+					if (min) {
+						lo = std::max(lo, *min);
+						hi = std::min(hi, *max);
+					}
+					continue;
+				}
+				auto value = e.get_value();
+				auto p = period(value);
+				if (!p)
+					continue;
+				if (op == Op::EQ || op == Op::GE || op == Op::GT)
+					lo = std::max(lo, *p);
+				if (op == Op::EQ || op == Op::LE || op == Op::LT)
+					hi = std::min(hi, *p);
+			}
+		}
+		for (auto & [period, name] : list) {
+			if (lo <= period && period <= hi)
+				tables.push_back(std::move(name));
+		}
+		if (tables.empty()) {
+			_log.debug("No partitions for '{}'", select.message->name);
+			_end_of_data();
+			return 0;
+		}
+	} else
+		tables.push_back(select.table);
+
+	std::list<std::string> selects;
+	for (auto & t : tables) {
+		auto str = fmt::format("SELECT {} FROM {}", join(names.begin(), names.end()), _quoted_table(t));
+		if (where.size())
+			str += std::string(" WHERE ") + join(" AND ", where.begin(), where.end());
+		selects.push_back(str);
+	}
+	auto str = join(" UNION ALL ", selects.begin(), selects.end());
+	if (select.with_seq && tables.size() > 1)
+		str += fmt::format(" ORDER BY {}", _quoted("_tll_seq"));
+
+	// Each table in UNION gets its own copy of parameters
+	std::vector<Parameter> bound;
+	bound.reserve(params.size() * tables.size());
+	for (auto i = 0u; i < tables.size(); i++)
+		bound.insert(bound.end(), params.begin(), params.end());
+	if (bound.size() > _max_params)
+		return _log.fail(E2BIG, "Query for {} needs {} parameters for {} partitions, limit is {}",
+				select.message->name, bound.size(), tables.size(), _max_params);
+
+	if (_prefetch && _transaction)
+		_log.debug("Prefetch connection does not see uncommitted rows, query in transaction is read inline");
+	else if (_prefetch && select.storage == Prepared::Storage::Columns) {
+		// Statement is executed and fetched in helper thread on separate prefetch connection
+		if (auto r = _fetcher_add(select, false, str, std::move(bound)); r) {
+			_fetch_stop();
+			return r;
+		}
+		_fetch_start(select);
+		return 0;
+	}
+
+	_select_sql = _prepare_select(str, select.message->msgid);
+	if (!_select_sql)
+		return _log.fail(EINVAL, "Failed to prepare select statement for table {}: {}", select.message->name, str);
+
+	if (auto r = sql_bind(_select_sql, bound, 1); !SQL_SUCCEEDED(r))
+		return _log.fail(EINVAL, "Failed to bind expression parameters: {}", odbcerror(_select_sql));
+
+	auto start = _slow_start();
+	auto r = _execute(_select_sql, "select", select.message->msgid);
+	_slow_check(start, "select", select, str, 0, [&bound]() { return render_params(bound); });
+	if (r == ETIMEDOUT) {
+		_select_sql.reset();
+		_end_of_data(odbc_scheme::EndOfData::Status::Timeout);
+		return 0;
+	}
+	if (r)
+		return r;
+
+	_select = &select;
+	_select_query = str;
+
+	if (auto r = _bind_columns(_select_sql, _select); r)
+		return r;
+
+	if (_spool)
+		return _spool_fill();
+
+	_update_dcaps(dcaps::Process | dcaps::Pending);
+	return 0;
+}
+
+int ODBC::_merge_query(const tll_msg_t *msg)
+{
+	if (_select)
+		return _log.fail(EINVAL, "Previous query is not finished, can not start new");
+	if (_transaction)
+		return _log.fail(EINVAL, "Merged query is read on pooled connections and can not be used in transaction");
+	if (auto r = _spill_flush(); r)
+		return r;
+
+	auto query = odbc_scheme::MergeQuery::bind(*msg);
+	auto greater = [](const std::unique_ptr<MergeCursor> &l, const std::unique_ptr<MergeCursor> &r) { return l->front()->seq > r->front()->seq; };
+
+	_cache_fill.reset();
+	_batch_rows.clear();
+	_merge.clear();
+	Prepared * first = nullptr;
+	for (auto id : query.get_messages()) {
+		auto ptr = _lookup(id);
+		if (!ptr)
+			return _log.fail(ENOENT, "Message {} not found in scheme", id);
+		auto & select = *ptr;
+		if (!select.with_seq || select.storage != Prepared::Storage::Columns || select.rows || select.partition.mode != Prepared::Partition::None)
+			return _log.fail(EINVAL, "Message {} can not be merged: plain table with seq column is required", select.message->name);
+		if (!first)
+			first = &select;
+
+		std::list<std::string> names = { _quoted("_tll_seq") };
+		for (auto & c : select.convert)
+			names.push_back(_quoted(c.field->name));
+		auto str = fmt::format("SELECT {} FROM {} ORDER BY {}", join(names.begin(), names.end()), _quoted_table(select.table), _quoted("_tll_seq"));
+
+		// Each cursor gets its own connection: some drivers do not allow several active cursors on one
+		// connection, others buffer whole result of each one
+		auto & c = *_merge.emplace_back(new MergeCursor);
+		if (_pool_get(c.db)) {
+			_merge.clear();
+			return _log.fail(EINVAL, "Failed to connect for merged query");
+		}
+		c.select.sql = _with_timeout(_prepare(c.db, str, select.message->msgid));
+		if (!c.select.sql) {
+			_merge.clear();
+			return _log.fail(EINVAL, "Failed to prepare merge statement for {}: {}", select.message->name, str);
+		}
+		c.select.message = select.message;
+		c.select.with_seq = true;
+		c.select.convert.resize(select.convert.size());
+		for (auto i = 0u; i < select.convert.size(); i++)
+			_init_convert(c.select.convert[i], select.convert[i].field);
+
+		auto r = _bind_columns(c.select.sql, &c.select, c.buf, c.seq, c.seq_param);
+		if (!r)
+			r = _execute(c.select.sql, "select", select.message->msgid);
+		if (!r)
+			r = _merge_fill(c);
+		if (r == ETIMEDOUT) {
+			_merge.clear();
+			_end_of_data(odbc_scheme::EndOfData::Status::Timeout);
+			return 0;
+		}
+		if (r && r != ENOENT) {
+			_merge.clear();
+			return r;
+		}
+		if (c.block.empty())
+			_merge.pop_back();
+	}
+
+	if (_merge.empty()) {
+		_log.debug("No data for merged query");
+		_end_of_data();
+		return 0;
+	}
+
+	std::make_heap(_merge.begin(), _merge.end(), greater);
+	_select = first;
+	_update_dcaps(dcaps::Process | dcaps::Pending);
+	return 0;
+}
+
+int ODBC::_merge_fill(MergeCursor &c)
+{
+	c.block.clear();
+	if (!c.select.sql) // Cursor is exhausted
+		return 0;
+
+	ODBC_PROBE(fetch_start, c.select.message->msgid, 0, 0, 0);
+	SQLRETURN r = SQL_SUCCESS;
+	while (c.block.count < _fetch_block && SQL_SUCCEEDED(r = SQLFetch(c.select.sql))) {
+		size_t size = 0;
+		if (auto r = _unpack(c.select, c.buf, size); r)
+			return r;
+		c.block.push_back(c.seq, c.buf.data(), size);
+	}
+	ODBC_PROBE(fetch_done, c.select.message->msgid, c.seq, c.block.count, r);
+
+	if (SQL_SUCCEEDED(r))
+		return 0;
+	if (r != SQL_NO_DATA) { // Lost pooled connection is reopened on next use
+		auto error = odbcerror(c.select.sql);
+		if (_timeout_state()) {
+			_log.warning("Merged query timed out: {}", error);
+			return ETIMEDOUT;
+		}
+		return _log.fail(EINVAL, "Failed to fetch {} data: {}", c.select.message->name, error);
+	}
+	SQLCloseCursor(c.select.sql);
+	c.select.sql.reset();
+	c.db.reset();
+	return 0;
+}
+
+int ODBC::_process_merge()
+{
+	auto greater = [](const std::unique_ptr<MergeCursor> &l, const std::unique_ptr<MergeCursor> &r) { return l->front()->seq > r->front()->seq; };
+
+	// Cursor is taken out of heap while row is emitted, callback may cancel query
+	std::pop_heap(_merge.begin(), _merge.end(), greater);
+	auto cursor = std::move(_merge.back());
+	_merge.pop_back();
+
+	auto record = cursor->front();
+	cursor->block.offset += Fetcher::Block::record_size(record->size);
+
+	_msg.msgid = cursor->select.message->msgid;
+	_msg.seq = record->seq;
+	_msg.data = record + 1;
+	_msg.size = record->size;
+	_emit_data(&_msg);
+	if (!_select)
+		return 0;
+
+	if (cursor->block.empty()) {
+		if (auto r = _merge_fill(*cursor); r) {
+			_merge.clear();
+			_select = nullptr;
+			_update_pending();
+			if (r == ETIMEDOUT) {
+				_end_of_data(odbc_scheme::EndOfData::Status::Timeout);
+				return 0;
+			}
+			return r;
+		}
+	}
+	if (!cursor->block.empty()) {
+		_merge.push_back(std::move(cursor));
+		std::push_heap(_merge.begin(), _merge.end(), greater);
+	}
+
+	if (_merge.empty()) {
+		_log.debug("End of merged data");
+		_select = nullptr;
+		_update_pending();
+		_end_of_data();
+	}
+	return 0;
+}
+
+int ODBC::_spool_fill()
+{
+	// Any failure leaves channel without active query, as if cursor was drained
+	auto cleanup = [this]() {
+		SQLCloseCursor(_select_sql);
+		_select_sql.reset();
+		_select = nullptr;
+		if (_spool_journal.is_open())
+			_spool_journal.reset();
+		else // Failed open or grow, map it again on next query
+			_spool_mapped = 0;
+		_update_pending();
+	};
+
+	if (_spool_mapped < _spool_size) {
+		if (auto r = _spool_journal.open(_spool_file, _spool_size); r) {
+			cleanup();
+			return _log.fail(EINVAL, "Failed to open spool file '{}': {}", _spool_file, strerror(r));
+		}
+		_spool_mapped = _spool_size;
+	}
+	_spool_journal.reset();
+	_spool_generation++;
+
+	// Cursor is drained without waiting for consumer and closed, rows are replayed from process
+	tll_msg_t msg = { TLL_MESSAGE_DATA };
+	msg.msgid = _select->message->msgid;
+	size_t rows = 0;
+	SQLRETURN r;
+	ODBC_PROBE(fetch_start, msg.msgid, 0, 0, 0);
+	while (SQL_SUCCEEDED(r = SQLFetch(_select_sql))) {
+		size_t size = 0;
+		if (_select->storage == Prepared::Storage::Blob) {
+			if (auto r = _fetch_blob(_select_sql, _select->with_seq ? 2 : 1, size); r) {
+				cleanup();
+				return r;
+			}
+		} else if (auto r = _unpack(*_select, _buf, size); r) {
+			cleanup();
+			return r;
+		}
+
+		msg.seq = _msg.seq;
+		msg.data = _buf.data();
+		msg.size = size;
+		while (_spool_journal.push(&msg) == ENOSPC) {
+			// Journal is reopened with pending records preserved
+			if (auto r = _spool_journal.open(_spool_file, _spool_mapped * 2); r) {
+				_log.error("Failed to grow spool file '{}' to {} bytes: {}", _spool_file, _spool_mapped * 2, strerror(r));
+				cleanup();
+				return EINVAL;
+			}
+			_spool_mapped *= 2;
+		}
+		rows++;
+	}
+	ODBC_PROBE(fetch_done, msg.msgid, rows ? msg.seq : 0, rows, r);
 
-	std::string_view ustr = unique ? "UNIQUE " : "";
-	auto str = fmt::format("CREATE {} INDEX {}{} on {}({})", ustr, _if_not_exists(), _quoted(fmt::format("_tll_{}_{}", name, key)), _quoted(name), _quoted(key));
-	sql = _prepare(str);
-	if (!sql)
-		return _log.fail(EINVAL, "Failed to prepare index statement: {}", str);
+	if (r != SQL_NO_DATA) {
+		auto error = odbcerror(_select_sql);
+		auto timeout = _timeout_state();
+		auto fatal = _sqlstate == "08S01";
+		cleanup();
+		if (timeout) {
+			_log.warning("Query timed out: {}", error);
+			_end_of_data(odbc_scheme::EndOfData::Status::Timeout);
+			return 0;
+		}
+		if (fatal) {
+			_connection_lost();
+			return state_fail(EINVAL, "Failed to fetch data: {}", error);
+		}
+		return _log.fail(EINVAL, "Failed to fetch data: {}", error);
+	}
+	SQLCloseCursor(_select_sql);
+	_select_sql.reset();
 
-	if (auto r = SQLExecute(sql); r != SQL_SUCCESS && r != SQL_NO_DATA)
-		return _log.fail(EINVAL, "Failed to create index for '{}': {}", name, key);
+	_log.debug("Spooled {} rows of '{}', {} bytes", rows, _select->message->name, _spool_journal.used());
+	_spool_active = true;
+	_update_dcaps(dcaps::Process | dcaps::Pending);
 	return 0;
 }
 
-int ODBC::_post(const tll_msg_t *msg, int flags)
+int ODBC::_process_spool()
 {
-	if (msg->type != TLL_MESSAGE_DATA) {
-		if (msg->type == TLL_MESSAGE_CONTROL)
-			return _post_control(msg, flags);
+	tll_msg_t msg = {};
+	if (_spool_journal.front(msg)) {
+		_log.debug("End of spooled data");
+		_spool_active = false;
+		_select = nullptr;
+		_update_pending();
+		_end_of_data();
 		return 0;
 	}
+	auto generation = _spool_generation;
+	_emit_data(&msg);
+	// Callback can cancel query or start new one that refills spool, current row is already gone
+	if (!_spool_active || generation != _spool_generation)
+		return 0;
+	_spool_journal.pop();
+	return 0;
+}
 
-	if (_select_sql)
-		return _log.fail(EINVAL, "Previous query is not finished, can not write data");
+int ODBC::_query_parallel(Prepared &select, std::string_view columns, const std::list<std::string> &where, const std::vector<Parameter> &params)
+{
+	auto seq = _quoted("_tll_seq");
+	auto table = _quoted_table(select.table);
+	std::string condition;
+	if (where.size())
+		condition = join(" AND ", where.begin(), where.end()) + " AND ";
 
-	if (msg->msgid == 0)
-		return _log.fail(EINVAL, "Unable to insert message without msgid");
-	auto it = _messages.find(msg->msgid);
-	if (it == _messages.end())
-		return _log.fail(ENOENT, "Message {} not found", msg->msgid);
-	auto & insert = it->second;
+	auto str = fmt::format("SELECT MIN({0}), MAX({0}) FROM {1}", seq, table);
+	if (where.size())
+		str += " WHERE " + join(" AND ", where.begin(), where.end());
+	auto sql = _with_timeout(_prepare(str, select.message->msgid));
+	if (!sql)
+		return _log.fail(EINVAL, "Failed to prepare range query for {}: {}", select.message->name, str);
 
-	if (!insert.sql) {
-		_log.trace("Skip message {} without SQL statement", insert.message->name);
+	auto bound = params;
+	if (auto r = sql_bind(sql, bound, 1); !SQL_SUCCEEDED(r))
+		return _log.fail(EINVAL, "Failed to bind expression parameters: {}", odbcerror(sql));
+	if (auto r = _execute(sql, "select range"); r == ETIMEDOUT) {
+		_end_of_data(odbc_scheme::EndOfData::Status::Timeout);
 		return 0;
-	}
+	} else if (r)
+		return r;
 
-	SQLFreeStmt(insert.sql, SQL_RESET_PARAMS);
+	long long range[2] = {};
+	SQLLEN param[2] = {};
+	for (auto i = 0; i < 2; i++) {
+		if (auto r = SQLBindCol(sql, i + 1, SQL_C_SBIGINT, &range[i], sizeof(range[i]), &param[i]); !SQL_SUCCEEDED(r))
+			return _log.fail(EINVAL, "Failed to bind seq range column: {}", odbcerror(sql));
+	}
+	if (auto r = SQLFetch(sql); !SQL_SUCCEEDED(r))
+		return _log.fail(EINVAL, "Failed to fetch seq range: {}", odbcerror(sql));
+	SQLCloseCursor(sql);
 
-	auto view = tll::make_view(*msg);
+	if (param[0] == SQL_NULL_DATA || param[1] == SQL_NULL_DATA) {
+		_log.debug("No data for '{}'", select.message->name);
+		_end_of_data();
+		return 0;
+	}
 
-	int idx = 1;
-	if (insert.with_seq) {
-		if (auto r = SQLBindParam(insert.sql, idx++, SQL_C_SBIGINT, SQL_BIGINT, 0, 0, (SQLPOINTER) &msg->seq, &_seq_param); !SQL_SUCCEEDED(r))
-			return _log.fail(EINVAL, "Failed to bind seq: {}", odbcerror(insert.sql));
+	// Split [min, max] into ranges of equal width, each one is read on its own connection
+	unsigned long long total = range[1] - range[0] + 1;
+	unsigned count = std::min<unsigned long long>(total, _parallel);
+	_log.info("Read '{}' seq range [{}, {}] with {} connections", select.message->name, range[0], range[1], count);
+
+	str = fmt::format("SELECT {} FROM {} WHERE {}{} >= ? AND {} <= ?", columns, table, condition, seq, seq);
+	if (_fetch_order == FetchOrder::Seq)
+		str += fmt::format(" ORDER BY {}", seq);
+
+	long long first = range[0];
+	for (auto i = 0u; i < count; i++) {
+		long long last = range[1];
+		if (i + 1 < count)
+			last = first + (total / count) + (i < total % count ? 1 : 0) - 1;
+
+		auto bound = params;
+		bound.emplace_back().integer = first;
+		bound.emplace_back().integer = last;
+		_log.debug("Range {}: [{}, {}]", i, first, last);
+		if (auto r = _fetcher_add(select, true, str, std::move(bound)); r)
+			return r;
+		first = last + 1;
 	}
-	auto pmap = insert.message->pmap;
-	for (auto & c : insert.convert) {
-		if (pmap && c.field->index >= 0) {
-			if (tll_scheme_pmap_get(view.view(pmap->offset).data(), c.field->index))
-				c.param = 0;
-			else
-				c.param = SQL_NULL_DATA;
+
+	_fetch_start(select);
+	return 0;
+}
+
+int ODBC::_fetcher_add(Prepared &select, bool connect, std::string_view query, std::vector<Parameter> &&params)
+{
+	auto & f = *_fetchers.emplace_back(new Fetcher);
+	f.depth = connect ? _parallel_depth : _fetch_depth;
+	if (connect && _pool_get(f.db))
+		return _log.fail(EINVAL, "Failed to connect for parallel read");
+	if (!connect && !_prefetch_db && _connect(_prefetch_db))
+		return _log.fail(EINVAL, "Failed to connect for prefetch");
+	f.select.sql = _with_timeout(_prepare(connect ? f.db : _prefetch_db, query, select.message->msgid));
+	if (!f.select.sql)
+		return _log.fail(EINVAL, "Failed to prepare select statement for {}: {}", select.message->name, query);
+	f.select.message = select.message;
+	f.select.with_seq = select.with_seq;
+	f.select.convert.resize(select.convert.size());
+	for (auto i = 0u; i < select.convert.size(); i++)
+		_init_convert(f.select.convert[i], select.convert[i].field);
+
+	f.params = std::move(params);
+	if (auto r = sql_bind(f.select.sql, f.params, 1); !SQL_SUCCEEDED(r))
+		return _log.fail(EINVAL, "Failed to bind expression parameters: {}", odbcerror(f.select.sql));
+	return _bind_columns(f.select.sql, &f.select, f.buf, f.seq, f.seq_param);
+}
+
+void ODBC::_fetch_start(Prepared &select)
+{
+	for (auto & f : _fetchers)
+		f->thread = std::thread([this, ptr = f.get()]() { _fetch_run(*ptr); });
+
+	_select = &select;
+	_update_dcaps(dcaps::Process | dcaps::Pending);
+}
+
+void ODBC::_fetch_run(Fetcher &f)
+{
+	auto msgid = f.select.message->msgid;
+	ODBC_PROBE(execute_start, msgid, 0, 0, 0);
+	auto r = SQLExecute(f.select.sql);
+	ODBC_PROBE(execute_done, msgid, 0, 0, r);
+	if (r != SQL_NO_DATA && !SQL_SUCCEEDED(r))
+		return f.finish(r, "execute");
+
+	// Probes cover fetch of whole block, seq is the last fetched one
+	Fetcher::Block block;
+	ODBC_PROBE(fetch_start, msgid, 0, 0, 0);
+	while (true) {
+		auto r = SQLFetch(f.select.sql);
+		if (SQL_SUCCEEDED(r)) {
+			size_t size = 0;
+			if (_unpack(f.select, f.buf, size))
+				return f.finish(SQL_ERROR, "convert");
+			block.push_back(f.seq, f.buf.data(), size);
+			if (block.count < _fetch_block)
+				continue;
 		}
-		if (sql_bind(insert.sql, c, idx++, view.view(c.field->offset)))
-			return _log.fail(EINVAL, "Failed to bind field {}: {}", c.field->name, odbcerror(insert.sql));
+		ODBC_PROBE(fetch_done, msgid, block.count ? f.seq : 0, block.count, r);
+
+		if (block.count && !f.push(block))
+			return f.finish(SQL_SUCCESS, "stop");
+		if (!SQL_SUCCEEDED(r))
+			return f.finish(r, "fetch");
+		ODBC_PROBE(fetch_start, msgid, 0, 0, 0);
 	}
+}
 
-	if (auto r = _execute(insert.sql, "insert"); r) {
-		if (r == ENOENT) {
-			if (!insert.output)
-				return 0;
-			tll_msg_t msg = {
-				.type = TLL_MESSAGE_CONTROL,
-				.msgid = odbc_scheme::EndOfData::meta_id(),
-			};
-			_callback(&msg);
+int ODBC::_process_fetch()
+{
+	while (_fetch_data.empty()) {
+		if (_fetchers.empty()) {
+			_log.debug("End of data");
+			_fetch_data = {};
+			_select = nullptr;
+			_update_pending();
+			_end_of_data();
 			return 0;
 		}
-		return r;
-	}
 
-	if (!insert.output) {
-		SQLCloseCursor(insert.sql);
-		return 0;
+		// In seq order ranges are emitted one after another, otherwise first ready block is taken
+		auto r = EAGAIN;
+		for (auto it = _fetchers.begin(); it != _fetchers.end(); ) {
+			auto & f = **it;
+			r = f.pop(_fetch_data);
+			if (r == 0)
+				break;
+			if (r == EAGAIN) {
+				if (_fetch_order == FetchOrder::Seq)
+					break;
+				it++;
+				continue;
+			}
+
+			f.thread.join();
+			if (f.result != SQL_NO_DATA && !SQL_SUCCEEDED(f.result)) {
+				auto error = fmt::format("Failed to {} data: {}", f.stage, odbcerror(f.select.sql));
+				auto fatal = _sqlstate == "08S01";
+				auto timeout = _timeout_state();
+				_fetch_stop();
+				_select = nullptr;
+				_update_pending();
+				if (timeout) {
+					_log.warning("Query timed out: {}", error);
+					_end_of_data(odbc_scheme::EndOfData::Status::Timeout);
+					return 0;
+				}
+				if (fatal)
+					return state_fail(EINVAL, "{}", error);
+				return _log.fail(EINVAL, "{}", error);
+			}
+			it = _fetchers.erase(it);
+			r = EAGAIN;
+		}
+		if (r == EAGAIN && _fetchers.size())
+			return EAGAIN;
 	}
 
-	{
-		_select_sql = insert.sql;
-		_select = insert.output;
+	auto record = reinterpret_cast<const Fetcher::Record *>(_fetch_data.data.data() + _fetch_data.offset);
+	_fetch_data.offset += Fetcher::Block::record_size(record->size);
 
-		auto view = tll::make_view(_buf);
-		_buf.resize(0);
-		_buf.resize(_select->message->size);
-		_buf.reserve(65536);
+	_msg.msgid = _select->message->msgid;
+	_msg.seq = record->seq;
+	_msg.data = record + 1;
+	_msg.size = record->size;
 
-		idx = 1;
-		if (_select->with_seq) {
-			if (auto r = SQLBindCol(_select_sql, idx++, SQL_C_SBIGINT, &_msg.seq, sizeof(_msg.seq), &_seq_param); !SQL_SUCCEEDED(r))
-				return _log.fail(EINVAL, "Failed to bind seq column: {}", odbcerror(_select_sql));
-		}
-		for (auto & c : _select->convert) {
-			_log.debug("Bind field {} at {}", c.field->name, c.field->offset);
-			if (sql_column(_select_sql, c, idx++, c.field, view.view(c.field->offset)))
-				return _log.fail(EINVAL, "Failed to bind field {} column: {}", c.field->name, odbcerror(_select_sql));
-		}
+	_emit_data(&_msg);
+	return 0;
+}
 
-		_update_dcaps(dcaps::Process | dcaps::Pending);
+void ODBC::_fetch_stop()
+{
+	for (auto & f : _fetchers)
+		f->stop();
+	_fetchers.clear();
+	_fetch_data = {};
+}
+
+void ODBC::_end_of_data(odbc_scheme::EndOfData::Status status)
+{
+	if (status != odbc_scheme::EndOfData::Status::Ok) {
+		// Partial results are not cached or batched
+		_cache_fill.reset();
+		_batch_rows.clear();
 	}
-	return 0;
+	if (_cache_fill)
+		_cache_store();
+	if (_batch_rows.count)
+		_batch_flush();
+
+	std::array<char, odbc_scheme::EndOfData::meta_size()> buf = {};
+	odbc_scheme::EndOfData::bind(buf).set_status(status);
+	tll_msg_t msg = { TLL_MESSAGE_CONTROL };
+	msg.msgid = odbc_scheme::EndOfData::meta_id();
+	msg.data = buf.data();
+	msg.size = buf.size();
+	_callback(&msg);
 }
 
-int ODBC::_execute(query_ptr_t &query, std::string_view message)
+int ODBC::_cancel()
 {
-	if (auto r = SQLExecute(query); !SQL_SUCCEEDED(r)) {
-		auto error = odbcerror(query);
-		if (_sqlstate == "08S01") // Fatal connection error
-			return state_fail(EINVAL, "Failed to {} data: {}", message, error);
-		if (r == SQL_NO_DATA) {
-			_log.debug("Query returned no data (SQL_NO_DATA)");
-			return ENOENT;
-		}
-		if (r == SQL_NEED_DATA)
-			return _log.fail(EINVAL, "Failed to {}: SQL_NEED_DATA: {}", message, error);
-		return _log.fail(EINVAL, "Failed to {} data: {}", message, error);
+	if (!_select) {
+		_log.debug("No active query, nothing to cancel");
+		return 0;
+	}
+	_log.info("Cancel active query");
+	_fetch_stop();
+	_cache_replay.reset();
+	_spool_active = false;
+	_merge.clear();
+	if (_select_sql) {
+		SQLCancel(_select_sql);
+		SQLCloseCursor(_select_sql);
+		_select_sql.reset();
 	}
+	_select = nullptr;
+	_update_pending();
+	_end_of_data(odbc_scheme::EndOfData::Status::Cancel);
 	return 0;
 }
 
-namespace {
-std::string_view operator_to_string(odbc_scheme::Expression::Operator op)
+bool ODBC::_cache_lookup(Prepared &select)
 {
-	using O = odbc_scheme::Expression::Operator;
-	switch (op) {
-	case O::EQ: return "=";
-	case O::NE: return "!=";
-	case O::LT: return "<";
-	case O::LE: return "<=";
-	case O::GT: return ">";
-	case O::GE: return ">=";
+	auto it = _cache_index.find(_cache_key);
+	if (it == _cache_index.end())
+		return false;
+	if (it->second->time + _cache_ttl < tll::time::now()) {
+		_log.debug("Cached result for '{}' is expired", select.message->name);
+		_cache_erase(it->second);
+		return false;
 	}
-	return "UNKNOWN-OPERATOR";
+
+	_log.debug("Replay cached result for '{}': {} bytes", select.message->name, it->second->data->data.size());
+	_cache_replay = it->second->data;
+	_cache_offset = 0;
+	_select = &select;
+	_update_dcaps(dcaps::Process | dcaps::Pending);
+	return true;
 }
 
-template <typename T>
-T * lookup(T * list, std::string_view id)
+void ODBC::_cache_store()
 {
-	for (auto i = list; i; i = i->next) {
-		if (i->name && i->name == id)
-			return i;
-	}
-	return nullptr;
+	std::shared_ptr<const Fetcher::Block> data(_cache_fill.release());
+	auto size = data->data.size();
+
+	if (auto it = _cache_index.find(_cache_key); it != _cache_index.end())
+		_cache_erase(it->second);
+	while (_cache.size() && _cache_size + size > _cache_limit)
+		_cache_erase(_cache.begin());
+
+	_cache.push_back({_cache_key, _cache_table, tll::time::now(), std::move(data)});
+	_cache_index.emplace(_cache_key, std::prev(_cache.end()));
+	_cache_size += size;
 }
+
+void ODBC::_cache_erase(std::list<CacheEntry>::iterator it)
+{
+	_cache_size -= it->data->data.size();
+	_cache_index.erase(it->key);
+	_cache.erase(it);
 }
 
-int ODBC::_post_control(const tll_msg_t *msg, int flags)
+void ODBC::_cache_invalidate(std::string_view table)
+{
+	for (auto it = _cache.begin(); it != _cache.end(); ) {
+		auto next = std::next(it);
+		if (it->table == table) {
+			_log.debug("Drop cached result for table {}", table);
+			_cache_erase(it);
+		}
+		it = next;
+	}
+}
+
+int ODBC::_process_cache()
 {
-	if (internal.caps & tll::caps::Output) {
-		// Handle begin/commit/rollback
+	auto & data = _cache_replay->data;
+	if (_cache_offset == data.size()) {
+		_log.debug("End of cached data");
+		_cache_replay.reset();
+		_select = nullptr;
+		_update_pending();
+		_end_of_data();
 		return 0;
 	}
 
-	if (msg->msgid != odbc_scheme::Query::meta_id())
-		return _log.fail(EINVAL, "Invalid control message id: {}", msg->msgid);
-	if (_select_sql)
-		return _log.fail(EINVAL, "Previous query is not finished, can not start new");
+	auto record = reinterpret_cast<const Fetcher::Record *>(data.data() + _cache_offset);
+	_cache_offset += Fetcher::Block::record_size(record->size);
 
-	auto query = odbc_scheme::Query::bind(*msg);
+	_msg.msgid = _select->message->msgid;
+	_msg.seq = record->seq;
+	_msg.data = record + 1;
+	_msg.size = record->size;
 
-	auto it = _messages.find(query.get_message());
-	if (it == _messages.end())
-		return _log.fail(ENOENT, "Message {} not found in scheme", query.get_message());
-	auto & select = it->second;
+	_emit_data(&_msg);
+	return 0;
+}
 
-	std::list<std::string> names;
-	if (select.with_seq)
-		names.push_back(_quoted("_tll_seq"));
-	for (auto & f : tll::util::list_wrap(select.message->fields)) {
-		if (&f == select.message->pmap)
+int ODBC::_batch_scheme()
+{
+	// Batch messages are appended to data scheme, each row field becomes list column
+	std::unique_ptr<char, decltype(&free)> dump(tll_scheme_dump(_scheme.get(), "yamls"), &free);
+	if (!dump)
+		return _log.fail(EINVAL, "Failed to dump data scheme");
+	std::string text = dump.get();
+	std::vector<std::pair<int, std::string>> names;
+	bool reload = false;
+
+	// Scheme may be already extended if channel is reopened
+	auto derived = [this](const tll::scheme::Message &m) {
+		auto row = _scheme->lookup(m.msgid - _batch_id_offset);
+		return row && m.name == fmt::format("{}Batch", row->name);
+	};
+
+	for (auto & m : tll::util::list_wrap(_scheme->messages)) {
+		if (m.msgid == 0 || derived(m))
 			continue;
-		names.push_back(_quoted(f.name));
+		auto name = fmt::format("{}Batch", m.name);
+		if (auto batch = _scheme->lookup(name); batch) {
+			if (!derived(*batch))
+				return _log.fail(EINVAL, "Batch message name {} is already used", name);
+			names.emplace_back(m.msgid, name);
+			continue;
+		}
+		if (_scheme->lookup(m.msgid + _batch_id_offset))
+			return _log.fail(EINVAL, "Batch message id {} for {} is already used", m.msgid + _batch_id_offset, m.name);
+		text += fmt::format("\n- name: '{}'\n  id: {}\n  fields:\n    - {{name: _tll_seq, type: '*int64'}}\n", name, m.msgid + _batch_id_offset);
+		for (auto & f : tll::util::list_wrap(m.fields)) {
+			if (&f == m.pmap) // Presence is not tracked per row
+				continue;
+			auto type = batch_type(&f);
+			if (type.empty()) {
+				_log.info("Field {}.{} is not included in batch message", m.name, f.name);
+				continue;
+			}
+			// Field options are applied to list elements to keep sub types like time_point or string
+			std::string options;
+			for (auto & o : tll::util::list_wrap(f.options)) {
+				std::string value = o.value ? o.value : "";
+				for (auto pos = value.find('\''); pos != value.npos; pos = value.find('\'', pos + 2))
+					value.replace(pos, 1, "''");
+				options += fmt::format(", list-options.{}: '{}'", o.name, value);
+			}
+			text += fmt::format("    - {{name: '{}', type: '*{}'{}}}\n", f.name, type, options);
+		}
+		names.emplace_back(m.msgid, name);
+		reload = true;
 	}
-	std::list<std::string> where;
-	for (auto & e : query.get_expression()) {
-		if (!lookup(select.message->fields, e.get_field()))
-			return _log.fail(ENOENT, "No such field '{}' in message {}", e.get_field(), select.message->name);
-		where.push_back(fmt::format("{} {} ?", _quoted(e.get_field()), operator_to_string(e.get_op())));
+
+	if (reload) {
+		_log.debug("Data scheme with batch messages:\n{}", text);
+		auto scheme = context().scheme_load(text);
+		if (!scheme)
+			return _log.fail(EINVAL, "Failed to load data scheme with batch messages");
+		_scheme.reset(scheme);
 	}
 
-	auto str = fmt::format("SELECT {} FROM {}", join(names.begin(), names.end()), _quoted(select.message->name));
-	if (where.size())
-		str += std::string(" WHERE ") + join(" AND ", where.begin(), where.end());
+	for (auto & [id, name] : names) {
+		auto message = _scheme->lookup(name);
+		auto row = _scheme->lookup(id);
+		if (!message || !row)
+			return _log.fail(EINVAL, "Batch message {} not found in scheme", name);
+		_batch_ids.insert(message->msgid);
+		auto & batch = _batch[id];
+		batch.message = message;
+		for (auto & f : tll::util::list_wrap(message->fields)) {
+			if (f.name == std::string_view("_tll_seq")) {
+				batch.seq = &f;
+				continue;
+			}
+			for (auto & rf : tll::util::list_wrap(row->fields)) {
+				if (rf.name == std::string_view(f.name))
+					batch.columns.emplace_back(&f, &rf);
+			}
+		}
+	}
+	return 0;
+}
 
-	_select_sql = _prepare(str);
-	if (!_select_sql)
-		return _log.fail(EINVAL, "Failed to prepare select statement for table {}: {}", select.message->name, str);
+void ODBC::_batch_flush()
+{
+	auto it = _batch.find(_batch_msgid);
+	if (it == _batch.end()) {
+		_log.error("No batch message for {}, drop {} rows", _batch_msgid, _batch_rows.count);
+		_batch_rows.clear();
+		return;
+	}
+	auto & batch = it->second;
+	auto count = _batch_rows.count;
+
+	std::vector<const Fetcher::Record *> rows;
+	rows.reserve(count);
+	for (size_t off = 0; off < _batch_rows.data.size(); ) {
+		auto r = reinterpret_cast<const Fetcher::Record *>(_batch_rows.data.data() + off);
+		rows.push_back(r);
+		off += Fetcher::Block::record_size(r->size);
+	}
 
-	std::vector<SQLLEN> param;
-	param.resize(query.get_expression().size());
-	auto idx = 0;
+	auto align = [](size_t v) { return (v + 7) & ~size_t(7); };
+	_batch_buf.clear();
+	_batch_buf.resize(batch.message->size);
+
+	// Allocate list of count elements in the tail and fill its offset pointer
+	auto list = [this, &align, count](const tll::scheme::Field * field, size_t entity) {
+		auto offset = align(_batch_buf.size());
+		_batch_buf.resize(offset + count * entity);
+		tll::scheme::generic_offset_ptr_t ptr = {};
+		ptr.offset = offset - field->offset;
+		ptr.size = count;
+		ptr.entity = entity;
+		tll::scheme::write_pointer(field, tll::make_view(_batch_buf).view(field->offset), ptr);
+		return offset;
+	};
 
-	for (auto & e : query.get_expression()) {
-		auto value = e.get_value();
-		_log.info("Bind expression field {} ({})", e.get_field(), idx + 1);
-		switch (value.union_type()) {
-		case value.index_i:
-			SQLBindParam(_select_sql, idx + 1, SQL_C_SBIGINT, SQL_BIGINT, 0, 0, (SQLPOINTER) value.view().view(1).data(), &param[idx]);
-			break;
-		case value.index_f:
-			SQLBindParam(_select_sql, idx + 1, SQL_C_DOUBLE, SQL_DOUBLE, 0, 0, (SQLPOINTER) value.view().view(1).data(), &param[idx]);
-			break;
-		case value.index_s: {
-			auto s = value.unchecked_s();
-			param[idx] = s.size();
-			SQLBindParam(_select_sql, idx + 1, SQL_C_CHAR, SQL_VARCHAR, 0, 0, (SQLPOINTER) s.data(), &param[idx]);
-			break;
+	if (batch.seq) {
+		auto offset = list(batch.seq, sizeof(int64_t));
+		for (auto i = 0u; i < count; i++)
+			*tll::make_view(_batch_buf).view(offset + i * sizeof(int64_t)).dataT<int64_t>() = rows[i]->seq;
+	}
+
+	for (auto & [field, rf] : batch.columns) {
+		if (rf->type != tll::scheme::Field::Pointer) {
+			auto offset = list(field, rf->size);
+			for (auto i = 0u; i < count; i++)
+				memcpy(_batch_buf.data() + offset + i * rf->size, reinterpret_cast<const char *>(rows[i] + 1) + rf->offset, rf->size);
+			continue;
 		}
+
+		auto elem = field->type_ptr;
+		auto offset = list(field, elem->size);
+		for (auto i = 0u; i < count; i++) {
+			auto row = tll::make_view(reinterpret_cast<const char *>(rows[i] + 1), rows[i]->size).view(rf->offset);
+			auto str = tll::scheme::read_pointer(rf, row);
+			tll::scheme::generic_offset_ptr_t ptr = {};
+			if (str && str->size) {
+				auto pos = _batch_buf.size();
+				_batch_buf.resize(pos + str->size);
+				memcpy(_batch_buf.data() + pos, row.view(str->offset).data(), str->size);
+				ptr.offset = pos - (offset + i * elem->size);
+				ptr.size = str->size;
+				ptr.entity = 1;
+			}
+			tll::scheme::write_pointer(elem, tll::make_view(_batch_buf).view(offset + i * elem->size), ptr);
 		}
-		idx++;
 	}
 
-	if (auto r = _execute(_select_sql, "select"); r)
+	_batch_rows.clear();
+
+	tll_msg_t msg = { TLL_MESSAGE_DATA };
+	msg.msgid = batch.message->msgid;
+	msg.seq = rows.size() ? rows.back()->seq : 0;
+	msg.data = _batch_buf.data();
+	msg.size = _batch_buf.size();
+	_callback_data(&msg);
+}
+
+void ODBC::_slow_record(tll::duration elapsed, std::string_view stage, const Prepared &prepared, std::string_view sql, long long seq, std::string params)
+{
+	auto & e = _slow_ring[_slow_count++ % _slow_ring.size()];
+	e.time = tll::time::now();
+	e.elapsed = elapsed;
+	e.stage = stage;
+	e.message = prepared.message->name;
+	e.seq = seq;
+	e.sql = sql;
+	e.params = std::move(params);
+
+	if (e.time < _slow_logged + _slow_interval) {
+		_slow_suppressed++;
+		return;
+	}
+	_slow_logged = e.time;
+	_log.warning("Slow {} of {} took {}, seq {}, parameters: [{}] ({} slow statements suppressed)\n\t{}",
+		stage, e.message, elapsed, seq, e.params, _slow_suppressed, e.sql);
+	_slow_suppressed = 0;
+}
+
+int ODBC::_slow_dump()
+{
+	auto size = std::min(_slow_count, _slow_ring.size());
+	auto now = tll::time::now();
+	_log.info("Last {} slow statements of {} total", size, _slow_count);
+	for (auto i = _slow_count - size; i < _slow_count; i++) {
+		auto & e = _slow_ring[i % _slow_ring.size()];
+		auto age = std::chrono::duration_cast<std::chrono::milliseconds>(now - e.time);
+		_log.info("{} ago: {} of {} took {}, seq {}, parameters: [{}]\n\t{}", age, e.stage, e.message, e.elapsed, e.seq, e.params, e.sql);
+	}
+	return 0;
+}
+
+int ODBC::_begin()
+{
+	if (_transaction)
+		return _log.fail(EINVAL, "Transaction is already started");
+	if (_shared)
+		return _log.fail(EINVAL, "Transactions are not supported on shared connection");
+	if (_select)
+		return _log.fail(EINVAL, "Previous query is not finished, can not start transaction");
+	// Messages from journal are written before transaction
+	if (auto r = _spill_flush(); r)
 		return r;
+	if (auto r = SQLSetConnectAttr(_db, SQL_ATTR_AUTOCOMMIT, (SQLPOINTER) SQL_AUTOCOMMIT_OFF, SQL_IS_UINTEGER); !SQL_SUCCEEDED(r))
+		return _log.fail(EINVAL, "Failed to disable autocommit: {}", odbcerror(_db));
+	_log.debug("Begin transaction");
+	_transaction = true;
+	_pending_seq = -1;
+	return 0;
+}
 
-	_select = &select;
+int ODBC::_end_transaction(SQLSMALLINT completion)
+{
+	auto name = completion == SQL_COMMIT ? "commit" : "rollback";
+	if (!_transaction)
+		return _log.fail(EINVAL, "No active transaction, can not {}", name);
+	if (_select)
+		return _log.fail(EINVAL, "Previous query is not finished, can not {} transaction", name);
+	if (completion == SQL_COMMIT) {
+		if (auto r = _spill_flush(); r)
+			return r;
+	}
+	ODBC_PROBE(commit_start, 0, _pending_seq, 0, completion);
+	auto r = SQLEndTran(SQL_HANDLE_DBC, _db, completion);
+	ODBC_PROBE(commit_done, 0, _pending_seq, 0, r);
+	if (!SQL_SUCCEEDED(r))
+		return _log.fail(EINVAL, "Failed to {} transaction: {}", name, odbcerror(_db));
+	_log.debug("Transaction {}", completion == SQL_COMMIT ? "committed" : "rolled back");
+	_transaction = false;
+	if (auto r = SQLSetConnectAttr(_db, SQL_ATTR_AUTOCOMMIT, (SQLPOINTER) SQL_AUTOCOMMIT_ON, SQL_IS_UINTEGER); !SQL_SUCCEEDED(r))
+		return _log.fail(EINVAL, "Failed to enable autocommit: {}", odbcerror(_db));
+	if (completion == SQL_COMMIT)
+		_committed(_pending_seq);
+	_pending_seq = -1;
+	return 0;
+}
 
-	auto view = tll::make_view(_buf);
-	_buf.resize(select.message->size);
-	_buf.reserve(65536);
+void ODBC::_committed(long long seq)
+{
+	if (!_commit_ack || seq <= _committed_seq)
+		return;
+	_committed_seq = seq;
+
+	std::array<char, odbc_scheme::Committed::meta_size()> buf = {};
+	odbc_scheme::Committed::bind(buf).set_seq(seq);
+	tll_msg_t msg = { TLL_MESSAGE_CONTROL };
+	msg.msgid = odbc_scheme::Committed::meta_id();
+	msg.seq = seq;
+	msg.data = buf.data();
+	msg.size = buf.size();
+	_callback(&msg);
+}
 
-	idx = 1;
-	if (_select->with_seq) {
-		if (auto r = SQLBindCol(_select_sql, idx++, SQL_C_SBIGINT, &_msg.seq, sizeof(_msg.seq), &_seq_param); !SQL_SUCCEEDED(r))
-			return _log.fail(EINVAL, "Failed to bind seq column: {}", odbcerror(_select_sql));
+int ODBC::_ping(const tll_msg_t *msg)
+{
+	auto mode = odbc_scheme::Ping::Mode::Dead;
+	if (msg->size >= odbc_scheme::Ping::meta_size())
+		mode = odbc_scheme::Ping::bind(*msg).get_mode();
+
+	// Connection is used by active cursor, second statement may fail on drivers without multiple active results
+	if (_select && (_select_sql || _fetchers.size() || _merge.size())) {
+		_log.debug("Skip ping while query is active");
+		return EAGAIN;
 	}
-	for (auto & c : select.convert) {
-		if (sql_column(_select_sql, c, idx++, c.field, view.view(c.field->offset)))
-			return _log.fail(EINVAL, "Failed to bind field {} column: {}", c.field->name, odbcerror(_select_sql));
+
+	SQLUINTEGER dead = SQL_CD_FALSE;
+	if (auto r = SQLGetConnectAttr(_db, SQL_ATTR_CONNECTION_DEAD, &dead, 0, nullptr); SQL_SUCCEEDED(r) && dead == SQL_CD_TRUE) {
+		_connection_lost();
+		return state_fail(EINVAL, "Database connection is dead");
 	}
 
-	_update_dcaps(dcaps::Process | dcaps::Pending);
+	if (mode != odbc_scheme::Ping::Mode::Select)
+		return 0;
+
+	if (!_ping_sql) {
+		_ping_sql = _prepare(_ping_query);
+		if (!_ping_sql)
+			return _log.fail(EINVAL, "Failed to prepare ping statement: {}", _ping_query);
+	}
+	if (auto r = _execute(_ping_sql, "ping"); r && r != ENOENT)
+		return r;
+	SQLCloseCursor(_ping_sql);
 	return 0;
 }
 
 int ODBC::_process(long timeout, int flags)
 {
-	if (!_select)
+	if (_shared_check())
+		return state_fail(EINVAL, "Shared connection is lost");
+	if (_cache_replay)
+		return _process_cache();
+	if (_spool_active)
+		return _process_spool();
+	if (_merge.size())
+		return _process_merge();
+	if (_fetchers.size())
+		return _process_fetch();
+	if (!_select) {
+		if (!_journal.empty())
+			return _spill_drain(64);
 		return _log.fail(EINVAL, "No active select statement");
+	}
 
+	// Seq is known only after row is fetched into bound column
+	auto start = _slow_start();
+	ODBC_PROBE(fetch_start, _select->message->msgid, 0, 0, 0);
 	auto r = SQLFetch(_select_sql);
+	auto seq = SQL_SUCCEEDED(r) && _select->with_seq ? _msg.seq : 0;
+	ODBC_PROBE(fetch_done, _select->message->msgid, seq, SQL_SUCCEEDED(r) ? 1 : 0, r);
+	_slow_check(start, "fetch", *_select, _select_query, seq, []() { return std::string(); });
 	if (!SQL_SUCCEEDED(r)) {
 		auto error = odbcerror(_select_sql);
 		_select = nullptr;
@@ -1066,24 +4432,47 @@ int ODBC::_process(long timeout, int flags)
 		_select_sql.reset();
 		if (r == SQL_NO_DATA) {
 			_log.debug("End of data");
-			_update_dcaps(0, dcaps::Process | dcaps::Pending);
-			tll_msg_t msg = { TLL_MESSAGE_CONTROL };
-			msg.msgid = odbc_scheme::EndOfData::meta_id();
-			_callback(&msg);
+			_update_pending();
+			_end_of_data();
+			return 0;
+		}
+		if (_timeout_state()) {
+			_log.warning("Query timed out: {}", error);
+			_update_pending();
+			_end_of_data(odbc_scheme::EndOfData::Status::Timeout);
 			return 0;
 		}
-		if (_sqlstate == "08S01")
+		if (_sqlstate == "08S01") {
+			_connection_lost();
 			return state_fail(EINVAL, "Failed to fetch data: {}", error);
+		}
 		return _log.fail(EINVAL, "Failed to fetch data: {}", error);
 	}
 
-	auto view = tll::make_view(_buf);
-	_buf.resize(_select->message->size);
+	size_t size = 0;
+	if (_select->storage == Prepared::Storage::Blob) {
+		if (auto r = _fetch_blob(_select_sql, _select->with_seq ? 2 : 1, size); r)
+			return r;
+	} else if (auto r = _unpack(*_select, _buf, size); r)
+		return r;
+
+	_msg.msgid = _select->message->msgid;
+	_msg.data = _buf.data();
+	_msg.size = size;
+
+	_emit_data(&_msg);
+	return 0;
+}
+
+int ODBC::_unpack(Prepared &select, std::vector<char> &buf, size_t &size)
+{
+	auto view = tll::make_view(buf);
+	size_t tail = select.message->size;
 
-	auto pmap = _select->message->pmap;
+	auto pmap = select.message->pmap;
 	if (pmap)
 		memset(view.view(pmap->offset).data(), 0, pmap->size);
-	for (auto & c : _select->convert) {
+	for (auto & c : select.convert) {
 		if (c.param == SQL_NULL_DATA) {
 			memset(view.view(c.field->offset).data(), 0, c.field->size);
 			continue;
@@ -1098,22 +4487,25 @@ int ODBC::_process(long timeout, int flags)
 			auto size = c.param;
 
 			tll::scheme::generic_offset_ptr_t ptr = {};
-			ptr.offset = data.size();
 			if (size == 0) {
-				ptr.offset = 0;
-				ptr.size = 0;
-				ptr.entity = 0;
 				tll::scheme::write_pointer(c.field, data, ptr);
 				continue;
 			}
+			if (size == SQL_NO_TOTAL || size >= (SQLLEN) c.string_size) {
+				_log.debug("Field {} truncated to {} bytes", c.field->name, c.string_size - 1);
+				size = c.string_size - 1;
+			}
 
+			// Compact string slots: tail never overtakes slot of current column
+			ptr.offset = tail - c.field->offset;
 			ptr.size = size + 1;
 			ptr.entity = 1;
 			tll::scheme::write_pointer(c.field, data, ptr);
-			auto fview = data.view(ptr.offset);
-			fview.resize(ptr.size);
-			memcpy(fview.data(), c.string, size);
-			*fview.view(size).template dataT<char>() = '\0';
+			auto dest = buf.data() + tail;
+			if (dest != c.string)
+				memmove(dest, c.string, size);
+			dest[size] = '\0';
+			tail += size + 1;
 		} else if (c.type == Prepared::Convert::String && c.field->type == tll::scheme::Field::Bytes) {
 			auto size = strnlen(c.string, c.field->size);
 			memcpy(data.data(), c.string, size);
@@ -1129,6 +4521,8 @@ int ODBC::_process(long timeout, int flags)
 
 			_log.debug("Decimal: sign {}, prec {}, scale {} {} {} ", n.sign, n.precision, n.scale, u128.mantissa.hi, u128.mantissa.lo);
 			data.dataT<tll::util::Decimal128>()->pack(u128);
+		} else if (c.type == Prepared::Convert::Scaled) {
+			decimal_from_scaled(c.integer, c.scale, *data.dataT<tll::util::Decimal128>());
 		} else if (c.type == Prepared::Convert::Timestamp) {
 			using tll::scheme::Field;
 			switch (c.field->type) {
@@ -1147,11 +4541,7 @@ int ODBC::_process(long timeout, int flags)
 		}
 	}
 
-	_msg.msgid = _select->message->msgid;
-	_msg.data = _buf.data();
-	_msg.size = _buf.size();
-
-	_callback_data(&_msg);
+	size = tail;
 	return 0;
 }
 
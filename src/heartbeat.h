@@ -6,6 +6,10 @@
 
 #include <fmt/chrono.h>
 
+#include <algorithm>
+
+#include "odbc-scheme.h"
+
 class HeartBeat : public tll::channel::Prefix<HeartBeat>
 {
 	using Base = tll::channel::Prefix<HeartBeat>;
@@ -16,6 +20,12 @@ class HeartBeat : public tll::channel::Prefix<HeartBeat>
 	std::vector<char> _buf;
 	std::unique_ptr<tll::Channel> _timer;
 
+	enum class Mode { Message, Probe } _mode = Mode::Message;
+	odbc_scheme::Ping::Mode _probe = odbc_scheme::Ping::Mode::Dead;
+	tll::duration _threshold = {};
+	size_t _window = 0;
+	std::vector<tll::duration> _samples;
+
  public:
 	static constexpr std::string_view channel_protocol() { return "db-heartbeat+"; }
 
@@ -28,15 +38,27 @@ class HeartBeat : public tll::channel::Prefix<HeartBeat>
 
 		auto reader = channel_props_reader(cfg);
 		_timeout = reader.getT<tll::duration>("timeout", 1s);
-		_message_name = reader.getT<std::string>("message");
+		_mode = reader.getT("mode", Mode::Message, {{"message", Mode::Message}, {"probe", Mode::Probe}});
+		_message_name = reader.getT<std::string>("message", "");
+		_probe = reader.getT("probe", odbc_scheme::Ping::Mode::Dead, {{"dead", odbc_scheme::Ping::Mode::Dead}, {"select", odbc_scheme::Ping::Mode::Select}});
+		_threshold = reader.getT<tll::duration>("threshold", 100ms);
+		_window = reader.getT<unsigned>("window", 100);
 		if (!reader)
 			return _log.fail(EINVAL, "Invalid url: {}", reader.error());
+		if (_mode == Mode::Message && _message_name.empty())
+			return _log.fail(EINVAL, "Heartbeat message is not set");
+		if (_window == 0)
+			return _log.fail(EINVAL, "Zero probe window");
 
 		auto curl = child_url_parse("timer://;dump=yes", "timer");
 		if (!curl)
 			return _log.fail(EINVAL, "Failed to parse timer url: {}", curl.error());
 		curl->set("clock", "monotonic");
-		curl->set("interval", fmt::format("{}", _timeout / 2));
+		// In probe mode database is checked each timeout, otherwise idle time is checked twice per timeout
+		if (_mode == Mode::Probe)
+			curl->set("interval", fmt::format("{}", _timeout));
+		else
+			curl->set("interval", fmt::format("{}", _timeout / 2));
 		_timer = context().channel(*curl);
 		if (!_timer)
 			return _log.fail(EINVAL, "Failed to create timer channel");
@@ -48,16 +70,27 @@ class HeartBeat : public tll::channel::Prefix<HeartBeat>
 
 	int _on_active()
 	{
-		auto s = scheme(TLL_MESSAGE_DATA);
-		if (!s)
-			return _log.fail(EINVAL, "Channel requires scheme");
-		auto message = s->lookup(_message_name);
-		if (!message)
-			return _log.fail(EINVAL, "Message {} not found in scheme", _message_name);
-		_msg.msgid = message->msgid;
-		_buf.resize(message->size);
-		_msg.data = _buf.data();
-		_msg.size = _buf.size();
+		if (_mode == Mode::Probe) {
+			_buf.resize(odbc_scheme::Ping::meta_size());
+			odbc_scheme::Ping::bind(_buf).set_mode(_probe);
+			_msg.type = TLL_MESSAGE_CONTROL;
+			_msg.msgid = odbc_scheme::Ping::meta_id();
+			_msg.data = _buf.data();
+			_msg.size = _buf.size();
+			_samples.clear();
+			_samples.reserve(_window);
+		} else {
+			auto s = scheme(TLL_MESSAGE_DATA);
+			if (!s)
+				return _log.fail(EINVAL, "Channel requires scheme");
+			auto message = s->lookup(_message_name);
+			if (!message)
+				return _log.fail(EINVAL, "Message {} not found in scheme", _message_name);
+			_msg.msgid = message->msgid;
+			_buf.resize(message->size);
+			_msg.data = _buf.data();
+			_msg.size = _buf.size();
+		}
 
 		_last = tll::time::now();
 		if (auto r = _timer->open(); r)
@@ -74,6 +107,8 @@ class HeartBeat : public tll::channel::Prefix<HeartBeat>
 
 	int _on_timer(const tll::Channel *, const tll_msg_t *)
 	{
+		if (_mode == Mode::Probe)
+			return _on_probe();
 		auto now = tll::time::now();
 		if (_last + _timeout > now)
 			return 0;
@@ -83,6 +118,65 @@ class HeartBeat : public tll::channel::Prefix<HeartBeat>
 		return 0;
 	}
 
+	int _on_probe()
+	{
+		auto start = std::chrono::steady_clock::now();
+		auto r = _child->post(&_msg);
+		auto latency = std::chrono::duration_cast<tll::duration>(std::chrono::steady_clock::now() - start);
+		if (r == EAGAIN) {
+			_log.debug("Database connection is busy with active query, probe skipped");
+			return 0;
+		}
+		if (r) {
+			// Only lost connection is fatal, other errors are reported as stall
+			if (_child->state() == tll::state::Error)
+				return state_fail(r, "Database probe failed");
+			_log.warning("Database probe failed: {}", r);
+			_stall(latency);
+			return 0;
+		}
+
+		if (latency > _threshold) {
+			_log.warning("Database probe latency {} exceeds threshold {}", latency, _threshold);
+			_stall(latency);
+		}
+
+		_samples.push_back(latency);
+		if (_samples.size() < _window)
+			return 0;
+
+		std::sort(_samples.begin(), _samples.end());
+		auto percentile = [this](unsigned p) { return _samples[std::min(_samples.size() - 1, _samples.size() * p / 100)]; };
+		_log.info("Database probe latency over {} samples: p50 {}, p90 {}, p99 {}, max {}",
+			_samples.size(), percentile(50), percentile(90), percentile(99), _samples.back());
+
+		std::vector<char> buf(odbc_scheme::ProbeStat::meta_size());
+		auto stat = odbc_scheme::ProbeStat::bind(buf);
+		stat.set_count(_samples.size());
+		stat.set_p50(percentile(50));
+		stat.set_p90(percentile(90));
+		stat.set_p99(percentile(99));
+		stat.set_max(_samples.back());
+		_samples.clear();
+		_control(odbc_scheme::ProbeStat::meta_id(), buf);
+		return 0;
+	}
+
+	void _stall(tll::duration latency)
+	{
+		std::vector<char> buf(odbc_scheme::Stall::meta_size());
+		odbc_scheme::Stall::bind(buf).set_latency(latency);
+		_control(odbc_scheme::Stall::meta_id(), buf);
+	}
+
+	void _control(int msgid, const std::vector<char> &buf)
+	{
+		tll_msg_t msg = { TLL_MESSAGE_CONTROL };
+		msg.msgid = msgid;
+		msg.data = buf.data();
+		msg.size = buf.size();
+		_callback(&msg);
+	}
 
 	int _post(const tll_msg_t * msg, int flags)
 	{
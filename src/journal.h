@@ -0,0 +1,163 @@
+#ifndef _CHANNEL_JOURNAL_H
+#define _CHANNEL_JOURNAL_H
+
+#include <tll/channel.h>
+
+#include <cerrno>
+#include <cstring>
+#include <string>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// FIFO of messages stored in memory mapped file, records are kept between restarts
+class Journal
+{
+	static constexpr uint64_t magic = 0x6c6e72756f6a6c74ull; // "tljournl"
+
+	struct Header {
+		uint64_t magic;
+		uint64_t head; // Offset of first record
+		uint64_t tail; // Offset after last record
+	};
+
+	struct Record {
+		uint32_t size;
+		int32_t msgid;
+		int64_t seq;
+	};
+
+	int _fd = -1;
+	char * _data = nullptr;
+	size_t _size = 0;
+
+	Header * header() { return reinterpret_cast<Header *>(_data); }
+	const Header * header() const { return reinterpret_cast<const Header *>(_data); }
+
+	static size_t record_size(size_t size) { return (sizeof(Record) + size + 7) & ~size_t(7); }
+
+ public:
+	Journal() = default;
+	Journal(const Journal &) = delete;
+	~Journal() { close(); }
+
+	bool is_open() const { return _data != nullptr; }
+	bool empty() const { return !_data || header()->head == header()->tail; }
+	size_t used() const { return _data ? header()->tail - header()->head : 0; }
+
+	// Open or create journal file, pending records from previous run are preserved
+	int open(const std::string &filename, size_t size)
+	{
+		close();
+		if (size < sizeof(Header) + sizeof(Record))
+			return EINVAL;
+		_fd = ::open(filename.c_str(), O_RDWR | O_CREAT, 0644);
+		if (_fd == -1)
+			return errno;
+
+		struct stat st = {};
+		if (fstat(_fd, &st))
+			return _close_errno();
+
+		bool pending = false;
+		if ((size_t) st.st_size >= sizeof(Header)) {
+			Header h = {};
+			if (pread(_fd, &h, sizeof(h), 0) == sizeof(h) && h.magic == magic && h.head < h.tail && h.tail <= (size_t) st.st_size)
+				pending = true;
+		}
+
+		if (pending && (size_t) st.st_size > size)
+			size = st.st_size;
+		if ((size_t) st.st_size != size && ftruncate(_fd, size))
+			return _close_errno();
+
+		auto ptr = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, _fd, 0);
+		if (ptr == MAP_FAILED)
+			return _close_errno();
+		_data = static_cast<char *>(ptr);
+		_size = size;
+		if (!pending)
+			reset();
+		return 0;
+	}
+
+	void close()
+	{
+		if (_data)
+			munmap(_data, _size);
+		_data = nullptr;
+		_size = 0;
+		if (_fd != -1)
+			::close(_fd);
+		_fd = -1;
+	}
+
+	// Drop all records
+	void reset()
+	{
+		auto h = header();
+		h->magic = magic;
+		h->head = h->tail = sizeof(Header);
+	}
+
+	// Append message, ENOSPC is returned if there is no space left
+	int push(const tll_msg_t * msg)
+	{
+		auto h = header();
+		auto size = record_size(msg->size);
+		if (h->tail + size > _size) {
+			if (h->head == sizeof(Header) || h->tail - h->head + sizeof(Header) + size > _size)
+				return ENOSPC;
+			// Move pending records to the beginning of the file
+			memmove(_data + sizeof(Header), _data + h->head, h->tail - h->head);
+			h->tail -= h->head - sizeof(Header);
+			h->head = sizeof(Header);
+		}
+
+		auto r = reinterpret_cast<Record *>(_data + h->tail);
+		r->size = msg->size;
+		r->msgid = msg->msgid;
+		r->seq = msg->seq;
+		if (msg->size)
+			memcpy(r + 1, msg->data, msg->size);
+		h->tail += size; // Record is visible only after it is completely written
+		return 0;
+	}
+
+	// Fill message with first record, data points into mapped file and is valid until next push
+	int front(tll_msg_t &msg) const
+	{
+		if (empty())
+			return ENOENT;
+		auto r = reinterpret_cast<const Record *>(_data + header()->head);
+		msg.type = TLL_MESSAGE_DATA;
+		msg.msgid = r->msgid;
+		msg.seq = r->seq;
+		msg.size = r->size;
+		msg.data = r + 1;
+		return 0;
+	}
+
+	void pop()
+	{
+		if (empty())
+			return;
+		auto h = header();
+		auto r = reinterpret_cast<const Record *>(_data + h->head);
+		h->head += record_size(r->size);
+		if (h->head == h->tail)
+			reset();
+	}
+
+ private:
+	int _close_errno()
+	{
+		auto r = errno;
+		close();
+		return r;
+	}
+};
+
+#endif//_CHANNEL_JOURNAL_H
@@ -3,9 +3,11 @@
 #include <tll/scheme/binder.h>
 #include <tll/util/conv.h>
 
+#include <chrono>
+
 namespace odbc_scheme {
 
-static constexpr std::string_view scheme_string = R"(yamls+gz://eJx1kUFPhDAQhe/8irk12UDCAmsMN3WJF+NmjTfjoSsDaSwtgWIkG/67U9xucTfeXt73Oq+dRqB4gzmwe6yFYgGAKHNYx0HkwINuGmEcSRbkRUt54B+fjqULVny3Hfa90PNMVEPT5yQA2K7FjhvdsRyOZmwpLJS5DecMWazYE4lDYI8FidSKVxIJiSfrbKywTkbi2TrraaLRg6IyV3KnRjt/9nJ4O55uJVgIv52MSm8yNoXgWOVZqYeDxCXsPexNJ1TNpndbWgmU5ak08qOse33iIqVbHzkv5TL0xeWAPmffNfkt7wfsRrf+LP73Qg19Ba/xz+vT5KoM/aedk6vFTy6aC1Xuqi033LVv4uAHLpCokg==)";
+static constexpr std::string_view scheme_string = R"(yamls+gz://eJy1VD1v2zAU3PMruBEI5EL+bKyttY0iQBM3dbaiAy09G0QoUhXJ1kag/15SEkVartAl2R54z3dn3lEjxEkOCcKf4Ug5vkGIZgkaxzcjB6xEnlPlkEmAfBeM7Un64rBpgG1ORQlSUlFzAte5TMyAEN4WUBIlSpygV3UuzDLl6i6qd8wR3jwZJI4Q/rIxw9QOz2aYmOH+0QwLM3y10NwOFpqZ4dGejKvKaGhuVJ3aJ362QvVZgn68tvYojlAjjo36YoarCDns4LFM6D2DEJQelKqk/Iirn1b0QIFlrejIU9nT61/0tkThV7rb6S/9JkyD37P/q7/CqFR+47ZZ6RJ50lCeXVSzeNBzbmIjR7i4oOnkSgx8wF4ySD1Q3vBse1gTRZz6PO51YqeI0tI3Ql9WYkV4CswGbJLevrT9eKY5CK1sN6rhCGRD3XlspQJ7qxKIgnuewckZXARN/mYja88/9o0/iAwGba+BZK3XHTBIVVfRgZu3ZJ3RmjqwaYwz5ozcDefHzJ/h6blf8AiJQtmH8cF1W5uiNfE5xGQnmFb1U8H84pJ2TPxZ67xwBpZXXwgFmf98DNuT8Ovq7QVUTdKOJ/wOPUB5hIsSjyf/bXEQ/K3rsU+2FHuwfegIp8OEqdA8eF3636+imMdvc/E92uU70S7fgzYnp7eh/QsY5PRL)";
 
 struct Begin
 {
@@ -72,7 +74,7 @@ struct Rollback
 
 struct Expression
 {
-	static constexpr size_t meta_size() { return 18; }
+	static constexpr size_t meta_size() { return 26; }
 	static constexpr std::string_view meta_name() { return "Expression"; }
 
 	enum class Operator: int8_t
@@ -83,6 +85,7 @@ struct Expression
 		GE = 3,
 		LT = 4,
 		LE = 5,
+		IN = 6,
 	};
 
 	template <typename Buf>
@@ -130,6 +133,10 @@ struct Expression
 		using type_value = Any<Buf>;
 		const type_value get_value() const { return this->template _get_binder<type_value>(9); }
 		type_value get_value() { return this->template _get_binder<type_value>(9); }
+
+		using type_list = tll::scheme::binder::List<Buf, Any<Buf>, tll_scheme_offset_ptr_t>;
+		const type_list get_list() const { return this->template _get_binder<type_list>(18); }
+		type_list get_list() { return this->template _get_binder<type_list>(18); }
 	};
 
 	template <typename Buf>
@@ -167,10 +174,17 @@ struct Query
 
 struct EndOfData
 {
-	static constexpr size_t meta_size() { return 0; }
+	static constexpr size_t meta_size() { return 1; }
 	static constexpr std::string_view meta_name() { return "EndOfData"; }
 	static constexpr int meta_id() { return 50; }
 
+	enum class Status: uint8_t
+	{
+		Ok = 0,
+		Cancel = 1,
+		Timeout = 2,
+	};
+
 	template <typename Buf>
 	struct binder_type : public tll::scheme::Binder<Buf>
 	{
@@ -180,6 +194,220 @@ struct EndOfData
 		static constexpr auto meta_name() { return EndOfData::meta_name(); }
 		static constexpr auto meta_id() { return EndOfData::meta_id(); }
 		void view_resize() { this->_view_resize(meta_size()); }
+
+		using type_status = Status;
+		type_status get_status() const { return this->template _get_scalar<type_status>(0); }
+		void set_status(type_status v) { return this->template _set_scalar<type_status>(0, v); }
+	};
+
+	template <typename Buf>
+	static binder_type<Buf> bind(Buf &buf, size_t offset = 0) { return binder_type<Buf>(tll::make_view(buf).view(offset)); }
+};
+
+struct CreateIndex
+{
+	static constexpr size_t meta_size() { return 0; }
+	static constexpr std::string_view meta_name() { return "CreateIndex"; }
+	static constexpr int meta_id() { return 60; }
+
+	template <typename Buf>
+	struct binder_type : public tll::scheme::Binder<Buf>
+	{
+		using tll::scheme::Binder<Buf>::Binder;
+
+		static constexpr auto meta_size() { return CreateIndex::meta_size(); }
+		static constexpr auto meta_name() { return CreateIndex::meta_name(); }
+		static constexpr auto meta_id() { return CreateIndex::meta_id(); }
+		void view_resize() { this->_view_resize(meta_size()); }
+	};
+
+	template <typename Buf>
+	static binder_type<Buf> bind(Buf &buf, size_t offset = 0) { return binder_type<Buf>(tll::make_view(buf).view(offset)); }
+};
+
+struct Ping
+{
+	static constexpr size_t meta_size() { return 1; }
+	static constexpr std::string_view meta_name() { return "Ping"; }
+	static constexpr int meta_id() { return 70; }
+
+	enum class Mode: uint8_t
+	{
+		Dead = 0,
+		Select = 1,
+	};
+
+	template <typename Buf>
+	struct binder_type : public tll::scheme::Binder<Buf>
+	{
+		using tll::scheme::Binder<Buf>::Binder;
+
+		static constexpr auto meta_size() { return Ping::meta_size(); }
+		static constexpr auto meta_name() { return Ping::meta_name(); }
+		static constexpr auto meta_id() { return Ping::meta_id(); }
+		void view_resize() { this->_view_resize(meta_size()); }
+
+		using type_mode = Mode;
+		type_mode get_mode() const { return this->template _get_scalar<type_mode>(0); }
+		void set_mode(type_mode v) { return this->template _set_scalar<type_mode>(0, v); }
+	};
+
+	template <typename Buf>
+	static binder_type<Buf> bind(Buf &buf, size_t offset = 0) { return binder_type<Buf>(tll::make_view(buf).view(offset)); }
+};
+
+struct Stall
+{
+	static constexpr size_t meta_size() { return 8; }
+	static constexpr std::string_view meta_name() { return "Stall"; }
+	static constexpr int meta_id() { return 80; }
+
+	template <typename Buf>
+	struct binder_type : public tll::scheme::Binder<Buf>
+	{
+		using tll::scheme::Binder<Buf>::Binder;
+
+		static constexpr auto meta_size() { return Stall::meta_size(); }
+		static constexpr auto meta_name() { return Stall::meta_name(); }
+		static constexpr auto meta_id() { return Stall::meta_id(); }
+		void view_resize() { this->_view_resize(meta_size()); }
+
+		using type_latency = std::chrono::duration<int64_t, std::nano>;
+		type_latency get_latency() const { return this->template _get_scalar<type_latency>(0); }
+		void set_latency(type_latency v) { return this->template _set_scalar<type_latency>(0, v); }
+	};
+
+	template <typename Buf>
+	static binder_type<Buf> bind(Buf &buf, size_t offset = 0) { return binder_type<Buf>(tll::make_view(buf).view(offset)); }
+};
+
+struct SlowDump
+{
+	static constexpr size_t meta_size() { return 0; }
+	static constexpr std::string_view meta_name() { return "SlowDump"; }
+	static constexpr int meta_id() { return 90; }
+
+	template <typename Buf>
+	struct binder_type : public tll::scheme::Binder<Buf>
+	{
+		using tll::scheme::Binder<Buf>::Binder;
+
+		static constexpr auto meta_size() { return SlowDump::meta_size(); }
+		static constexpr auto meta_name() { return SlowDump::meta_name(); }
+		static constexpr auto meta_id() { return SlowDump::meta_id(); }
+		void view_resize() { this->_view_resize(meta_size()); }
+	};
+
+	template <typename Buf>
+	static binder_type<Buf> bind(Buf &buf, size_t offset = 0) { return binder_type<Buf>(tll::make_view(buf).view(offset)); }
+};
+
+struct Committed
+{
+	static constexpr size_t meta_size() { return 8; }
+	static constexpr std::string_view meta_name() { return "Committed"; }
+	static constexpr int meta_id() { return 100; }
+
+	template <typename Buf>
+	struct binder_type : public tll::scheme::Binder<Buf>
+	{
+		using tll::scheme::Binder<Buf>::Binder;
+
+		static constexpr auto meta_size() { return Committed::meta_size(); }
+		static constexpr auto meta_name() { return Committed::meta_name(); }
+		static constexpr auto meta_id() { return Committed::meta_id(); }
+		void view_resize() { this->_view_resize(meta_size()); }
+
+		using type_seq = int64_t;
+		type_seq get_seq() const { return this->template _get_scalar<type_seq>(0); }
+		void set_seq(type_seq v) { return this->template _set_scalar<type_seq>(0, v); }
+	};
+
+	template <typename Buf>
+	static binder_type<Buf> bind(Buf &buf, size_t offset = 0) { return binder_type<Buf>(tll::make_view(buf).view(offset)); }
+};
+
+struct Cancel
+{
+	static constexpr size_t meta_size() { return 0; }
+	static constexpr std::string_view meta_name() { return "Cancel"; }
+	static constexpr int meta_id() { return 110; }
+
+	template <typename Buf>
+	struct binder_type : public tll::scheme::Binder<Buf>
+	{
+		using tll::scheme::Binder<Buf>::Binder;
+
+		static constexpr auto meta_size() { return Cancel::meta_size(); }
+		static constexpr auto meta_name() { return Cancel::meta_name(); }
+		static constexpr auto meta_id() { return Cancel::meta_id(); }
+		void view_resize() { this->_view_resize(meta_size()); }
+	};
+
+	template <typename Buf>
+	static binder_type<Buf> bind(Buf &buf, size_t offset = 0) { return binder_type<Buf>(tll::make_view(buf).view(offset)); }
+};
+
+struct MergeQuery
+{
+	static constexpr size_t meta_size() { return 8; }
+	static constexpr std::string_view meta_name() { return "MergeQuery"; }
+	static constexpr int meta_id() { return 120; }
+
+	template <typename Buf>
+	struct binder_type : public tll::scheme::Binder<Buf>
+	{
+		using tll::scheme::Binder<Buf>::Binder;
+
+		static constexpr auto meta_size() { return MergeQuery::meta_size(); }
+		static constexpr auto meta_name() { return MergeQuery::meta_name(); }
+		static constexpr auto meta_id() { return MergeQuery::meta_id(); }
+		void view_resize() { this->_view_resize(meta_size()); }
+
+		using type_messages = tll::scheme::binder::List<Buf, int32_t, tll_scheme_offset_ptr_t>;
+		const type_messages get_messages() const { return this->template _get_binder<type_messages>(0); }
+		type_messages get_messages() { return this->template _get_binder<type_messages>(0); }
+	};
+
+	template <typename Buf>
+	static binder_type<Buf> bind(Buf &buf, size_t offset = 0) { return binder_type<Buf>(tll::make_view(buf).view(offset)); }
+};
+
+struct ProbeStat
+{
+	static constexpr size_t meta_size() { return 36; }
+	static constexpr std::string_view meta_name() { return "ProbeStat"; }
+	static constexpr int meta_id() { return 130; }
+
+	template <typename Buf>
+	struct binder_type : public tll::scheme::Binder<Buf>
+	{
+		using tll::scheme::Binder<Buf>::Binder;
+
+		static constexpr auto meta_size() { return ProbeStat::meta_size(); }
+		static constexpr auto meta_name() { return ProbeStat::meta_name(); }
+		static constexpr auto meta_id() { return ProbeStat::meta_id(); }
+		void view_resize() { this->_view_resize(meta_size()); }
+
+		using type_count = uint32_t;
+		type_count get_count() const { return this->template _get_scalar<type_count>(0); }
+		void set_count(type_count v) { return this->template _set_scalar<type_count>(0, v); }
+
+		using type_p50 = std::chrono::duration<int64_t, std::nano>;
+		type_p50 get_p50() const { return this->template _get_scalar<type_p50>(4); }
+		void set_p50(type_p50 v) { return this->template _set_scalar<type_p50>(4, v); }
+
+		using type_p90 = std::chrono::duration<int64_t, std::nano>;
+		type_p90 get_p90() const { return this->template _get_scalar<type_p90>(12); }
+		void set_p90(type_p90 v) { return this->template _set_scalar<type_p90>(12, v); }
+
+		using type_p99 = std::chrono::duration<int64_t, std::nano>;
+		type_p99 get_p99() const { return this->template _get_scalar<type_p99>(20); }
+		void set_p99(type_p99 v) { return this->template _set_scalar<type_p99>(20, v); }
+
+		using type_max = std::chrono::duration<int64_t, std::nano>;
+		type_max get_max() const { return this->template _get_scalar<type_max>(28); }
+		void set_max(type_max v) { return this->template _set_scalar<type_max>(28, v); }
 	};
 
 	template <typename Buf>
@@ -198,6 +426,7 @@ struct tll::conv::dump<odbc_scheme::Expression::Operator> : public to_string_fro
 		case odbc_scheme::Expression::Operator::EQ: return "EQ";
 		case odbc_scheme::Expression::Operator::GE: return "GE";
 		case odbc_scheme::Expression::Operator::GT: return "GT";
+		case odbc_scheme::Expression::Operator::IN: return "IN";
 		case odbc_scheme::Expression::Operator::LE: return "LE";
 		case odbc_scheme::Expression::Operator::LT: return "LT";
 		case odbc_scheme::Expression::Operator::NE: return "NE";
@@ -206,3 +435,34 @@ struct tll::conv::dump<odbc_scheme::Expression::Operator> : public to_string_fro
 		return tll::conv::to_string_buf<int8_t, Buf>((int8_t) v, buf);
 	}
 };
+
+template <>
+struct tll::conv::dump<odbc_scheme::EndOfData::Status> : public to_string_from_string_buf<odbc_scheme::EndOfData::Status>
+{
+	template <typename Buf>
+	static inline std::string_view to_string_buf(const odbc_scheme::EndOfData::Status &v, Buf &buf)
+	{
+		switch (v) {
+		case odbc_scheme::EndOfData::Status::Cancel: return "Cancel";
+		case odbc_scheme::EndOfData::Status::Ok: return "Ok";
+		case odbc_scheme::EndOfData::Status::Timeout: return "Timeout";
+		default: break;
+		}
+		return tll::conv::to_string_buf<uint8_t, Buf>((uint8_t) v, buf);
+	}
+};
+
+template <>
+struct tll::conv::dump<odbc_scheme::Ping::Mode> : public to_string_from_string_buf<odbc_scheme::Ping::Mode>
+{
+	template <typename Buf>
+	static inline std::string_view to_string_buf(const odbc_scheme::Ping::Mode &v, Buf &buf)
+	{
+		switch (v) {
+		case odbc_scheme::Ping::Mode::Dead: return "Dead";
+		case odbc_scheme::Ping::Mode::Select: return "Select";
+		default: break;
+		}
+		return tll::conv::to_string_buf<uint8_t, Buf>((uint8_t) v, buf);
+	}
+};
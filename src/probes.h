@@ -0,0 +1,14 @@
+#ifndef _CHANNEL_PROBES_H
+#define _CHANNEL_PROBES_H
+
+// Static tracepoints for perf and bpftrace, provider tll_odbc. Each probe carries msgid, seq, row
+// count and status (ODBC return code or errno), probes are compiled out when usdt option is disabled
+
+#ifdef WITH_USDT
+# include <sys/sdt.h>
+# define ODBC_PROBE(name, msgid, seq, rows, status) DTRACE_PROBE4(tll_odbc, name, msgid, seq, rows, status)
+#else
+# define ODBC_PROBE(name, msgid, seq, rows, status) do {} while (0)
+#endif
+
+#endif//_CHANNEL_PROBES_H
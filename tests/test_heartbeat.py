@@ -39,3 +39,22 @@ def test_timestamp(context):
 
     c.close()
     assert c.state == c.State.Closed
+
+def test_probe(context, odbcini):
+    c = Accum('db-heartbeat+odbc://', name='client', context=context, scheme=SCHEME, timeout='10ms', mode='probe', probe='select', threshold='0ns', window='2', **{'default-template': 'none'}, **odbcini)
+
+    c.open()
+    assert c.state == c.State.Active
+
+    for _ in range(3):
+        time.sleep(0.01)
+        c.children[-1].process()
+
+    assert [(m.type, m.msgid) for m in c.result] == [(c.Type.Control, 80)] * 2 + [(c.Type.Control, 130), (c.Type.Control, 80)]
+    assert c.unpack(c.result[0]).latency.seconds > 0
+    stat = c.unpack(c.result[2])
+    assert stat.count == 2
+    assert stat.p50 <= stat.max
+
+    c.close()
+    assert c.state == c.State.Closed
@@ -3,7 +3,10 @@
 
 import pytest
 
+import calendar
 import datetime
+import struct
+import time
 from decimal import Decimal
 import pyodbc
 
@@ -80,6 +83,9 @@ def test_field(context, db, odbcini, t, value):
         ([{'field': 'f0', 'op': 'GT', 'value': {'i': 1000}}, {'field': 'f1', 'op': 'LE', 'value': {'f': 500}}], [2, 3, 4]),
         ([{'field': 'f0', 'op': 'GT', 'value': {'i': 5000}}, {'field': 'f1', 'op': 'LE', 'value': {'f': 500}}], []),
         ([{'field': 'f2', 'op': 'EQ', 'value': {'s': '2'}}], [2]),
+        ([{'field': 'f0', 'op': 'IN', 'list': [{'i': 1000}, {'i': 3000}, {'i': 9000}]}], [1, 3, 9]),
+        ([{'field': 'f2', 'op': 'IN', 'list': [{'s': '2'}, {'s': 'x'}]}, {'field': 'f0', 'op': 'GE', 'value': {'i': 0}}], [2]),
+        ([{'field': 'f0', 'op': 'IN', 'list': []}], []),
         ])
 def test_query(context, db, odbcini, query, result):
     scheme = '''yamls://
@@ -110,6 +116,36 @@ def test_query(context, db, odbcini, query, result):
     for m, r in zip(s.result, result):
         assert s.unpack(m).as_dict() == {'f0': 1000 * r, 'f1': 100.5 * r, 'f2': str(r)}
 
+def test_query_max_parameters(context, db, odbcini):
+    with db.cursor() as c:
+        c.execute('DROP TABLE IF EXISTS "Data"')
+
+    c = Accum('odbc://;name=odbc;create-mode=checked;max-parameters=4', scheme=SCHEME, dump='scheme', context=context, **odbcini)
+    c.open()
+    c.post({'f0': 1}, name='Data', seq=1)
+
+    c.post({'message': 10, 'expression': [{'field': 'f0', 'op': 'IN', 'list': [{'i': x} for x in range(4)]}]}, name='Query', type=c.Type.Control)
+    for _ in range(10):
+        c.process()
+    assert [(m.type, m.msgid, m.seq) for m in c.result] == [(c.Type.Data, 10, 1), (c.Type.Control, 50, 0)]
+
+    # Five values are padded to eight placeholders
+    with pytest.raises(TLLError):
+        c.post({'message': 10, 'expression': [{'field': 'f0', 'op': 'IN', 'list': [{'i': x} for x in range(5)]}]}, name='Query', type=c.Type.Control)
+
+def test_query_old_expression(context, db, odbcini):
+    with db.cursor() as c:
+        c.execute('DROP TABLE IF EXISTS "Data"')
+
+    c = Accum('odbc://;name=odbc;create-mode=checked', scheme=SCHEME, dump='scheme', context=context, **odbcini)
+    c.open()
+
+    # Query with one 18 byte Expression entry, layout before list field was added
+    msgid = c.scheme_control.messages.Query.msgid
+    data = struct.pack('<iII', 10, 8, 1 | (18 << 24)) + struct.pack('<QbbQ', 0, 0, 0, 1)
+    with pytest.raises(TLLError):
+        c.post(data, msgid=msgid, type=c.Type.Control)
+
 def test_function(context, db, odbcini):
     scheme = '''yamls://
     - name: Input
@@ -389,6 +425,33 @@ def test_timestamp(context, db, odbcini, t, prec, value):
     else:
         assert r == value
 
+def test_integer_storage(context, db, odbcini):
+    scheme = '''yamls://
+    - name: Data
+      id: 10
+      fields:
+        - {name: f0, type: int64, options.type: time_point, options.resolution: ns, options.sql.storage: integer}
+        - {name: f1, type: decimal128, options.sql.storage: integer, options.sql.scale: 3}
+    '''
+
+    with db.cursor() as c:
+        c.execute('DROP TABLE IF EXISTS "Data"')
+
+    c = Accum('odbc://;name=odbc;create-mode=checked', scheme=scheme, dump='scheme', context=context, **odbcini)
+    c.open()
+    ts = TimePoint.from_str('2000-01-02T03:04:05.678901234')
+    c.post({'f0': ts, 'f1': Decimal('-123.45')}, name='Data', seq=100)
+
+    assert [tuple(r) for r in db.cursor().execute(f'SELECT * FROM "Data"')] == [(100, 946782245678901234, -123450)]
+
+    with pytest.raises(TLLError):
+        c.post({'f0': ts, 'f1': Decimal('0.0001')}, name='Data', seq=101)
+
+    c.post({'message': 10}, name='Query', type=c.Type.Control)
+    c.process()
+    assert [(m.type, m.msgid, m.seq) for m in c.result] == [(c.Type.Data, 10, 100)]
+    assert c.unpack(c.result[-1]).as_dict() == {'f0': ts, 'f1': Decimal('-123.450')}
+
 def test_default_template(context, db, odbcini):
     scheme = '''yamls://
     - name: Data
@@ -433,3 +496,823 @@ def test_non_strict(context, db, odbcini):
     c.post({'f0': 1000}, name='Data', seq=100)
 
     assert [tuple(r) for r in db.cursor().execute(f'SELECT * FROM "Data"')] == [(100, 1000)]
+
+def test_strings(context, db, odbcini):
+    scheme = '''yamls://
+    - name: Data
+      id: 10
+      fields:
+        - {name: s0, type: string}
+        - {name: f0, type: int32}
+        - {name: s1, type: string}
+    '''
+
+    with db.cursor() as c:
+        c.execute('DROP TABLE IF EXISTS "Data"')
+
+    data = [('', 0, 'a'), ('abc', 1, ''), ('x' * 3000, 2, 'y' * 10), ('z' * 5000, 3, 'z')]
+
+    c = Accum('odbc://;name=odbc;create-mode=checked;string-size=4096', scheme=scheme, dump='scheme', context=context, **odbcini)
+    c.open()
+    for i, (s0, f0, s1) in enumerate(data):
+        c.post({'s0': s0, 'f0': f0, 's1': s1}, name='Data', seq=i)
+
+    c.post({'message': 10}, name='Query', type=c.Type.Control)
+    for _ in range(10):
+        c.process()
+
+    assert [(m.type, m.msgid, m.seq) for m in c.result] == [(c.Type.Data, 10, i) for i in range(len(data))] + [(c.Type.Control, 50, 0)]
+    data[-1] = ('z' * 4095, 3, 'z') # Truncated
+    assert [c.unpack(m).as_dict() for m in c.result[:-1]] == [{'s0': s0, 'f0': f0, 's1': s1} for s0, f0, s1 in data]
+
+def test_blob(context, db, odbcini):
+    scheme = '''yamls://
+    - name: Sub
+      fields:
+        - {name: s0, type: int16}
+        - {name: s1, type: string}
+    - name: Data
+      id: 10
+      options.sql.storage: blob
+      fields:
+        - {name: f0, type: int32, options.sql.index: yes}
+        - {name: f1, type: '*Sub'}
+        - {name: f2, type: 'int64[4]'}
+        - {name: f3, type: string}
+    '''
+
+    with db.cursor() as c:
+        c.execute('DROP TABLE IF EXISTS "Data"')
+
+    data = [{'f0': x, 'f1': [{'s0': i, 's1': str(i)} for i in range(x)], 'f2': list(range(x)), 'f3': 'x' * 100 * x} for x in range(4)]
+
+    c = Accum('odbc://;name=odbc;create-mode=checked', scheme=scheme, dump='scheme', context=context, **odbcini)
+    c.open()
+    for i, d in enumerate(data):
+        c.post(d, name='Data', seq=i)
+
+    assert [tuple(r)[:2] for r in db.cursor().execute('SELECT * FROM "Data"')] == [(i, i) for i in range(4)]
+
+    c.post({'message': 10, 'expression': [{'field': 'f0', 'op': 'GE', 'value': {'i': 2}}]}, name='Query', type=c.Type.Control)
+    for _ in range(10):
+        c.process()
+
+    assert [(m.type, m.msgid, m.seq) for m in c.result] == [(c.Type.Data, 10, 2), (c.Type.Data, 10, 3), (c.Type.Control, 50, 0)]
+    assert [c.unpack(m).as_dict() for m in c.result[:-1]] == data[2:]
+
+    with pytest.raises(TLLError): c.post({'message': 10, 'expression': [{'field': 'f3', 'op': 'EQ', 'value': {'s': ''}}]}, name='Query', type=c.Type.Control)
+
+def test_partition(context, db, odbcini):
+    scheme = '''yamls://
+    - name: Data
+      id: 10
+      options.sql.partition: daily
+      options.sql.partition-field: ts
+      fields:
+        - {name: ts, type: int64, options.type: time_point, options.resolution: s, options.sql.storage: integer}
+        - {name: f0, type: int32}
+    '''
+
+    with db.cursor() as c:
+        for t in ['Data', 'Data_20240101', 'Data_20240102', 'Data_20240103', 'Data_20240104']:
+            c.execute(f'DROP TABLE IF EXISTS "{t}"')
+
+    def tables():
+        return sorted(r.table_name for r in db.cursor().tables(table='Data_%'))
+
+    c = Accum('odbc://;name=odbc;create-mode=checked;partition-interval=10ms', scheme=scheme, dump='scheme', context=context, **odbcini)
+    c.open()
+    assert tables() == [] # Partition is not known before first insert
+
+    for i, ts in enumerate(['2024-01-01T10:00:00', '2024-01-01T23:59:59', '2024-01-02T00:00:00', '2024-01-03T12:00:00']):
+        c.post({'ts': TimePoint.from_str(ts), 'f0': i}, name='Data', seq=i)
+
+    assert [r[1] for r in db.cursor().execute('SELECT * FROM "Data_20240101"')] == [0, 1]
+    assert [r[1] for r in db.cursor().execute('SELECT * FROM "Data_20240102"')] == [2]
+    assert [r[1] for r in db.cursor().execute('SELECT * FROM "Data_20240103"')] == [3]
+
+    time.sleep(0.01)
+    c.children[-1].process()
+    assert tables() == ['Data_20240101', 'Data_20240102', 'Data_20240103', 'Data_20240104']
+
+    c.post({'message': 10, 'expression': [{'field': 'f0', 'op': 'GE', 'value': {'i': 1}}]}, name='Query', type=c.Type.Control)
+    for _ in range(10):
+        c.process()
+
+    assert [(m.type, m.msgid, m.seq) for m in c.result] == [(c.Type.Data, 10, i) for i in [1, 2, 3]] + [(c.Type.Control, 50, 0)]
+    assert [c.unpack(m).f0 for m in c.result[:-1]] == [1, 2, 3]
+
+    c.result = []
+    ts = calendar.timegm((2024, 1, 2, 0, 0, 0))
+    c.post({'message': 10, 'expression': [{'field': 'ts', 'op': 'LT', 'value': {'i': ts}}]}, name='Query', type=c.Type.Control)
+    for _ in range(10):
+        c.process()
+    assert [m.seq for m in c.result[:-1]] == [0, 1]
+
+def test_deferred_index(context, db, odbcini):
+    scheme = '''yamls://
+    - name: Data
+      id: 10
+      fields:
+        - {name: f0, type: int32, options.sql.index: yes}
+    '''
+
+    with db.cursor() as c:
+        c.execute('DROP TABLE IF EXISTS "Data"')
+
+    def indexes():
+        with db.cursor() as c:
+            return sorted(r.index_name for r in c.statistics('Data') if r.index_name is not None)
+
+    c = Accum('odbc://;name=odbc;create-mode=checked;index-mode=deferred', scheme=scheme, dump='scheme', context=context, **odbcini)
+    c.open()
+    for i in range(10):
+        c.post({'f0': i}, name='Data', seq=i)
+
+    assert indexes() == []
+
+    c.post({}, name='CreateIndex', type=c.Type.Control)
+    assert indexes() == ['_tll_Data__tll_seq', '_tll_Data_f0']
+
+    c.close()
+    c.open()
+    c.close()
+    assert indexes() == ['_tll_Data__tll_seq', '_tll_Data_f0']
+
+def test_prepare_lazy(context, db, odbcini, caplog):
+    scheme = '''yamls://
+    - name: Data
+      id: 10
+      fields:
+        - {name: f0, type: int32}
+    - name: Other
+      id: 20
+      fields:
+        - {name: f0, type: int32}
+    - name: List
+      id: 30
+      fields:
+        - {name: f0, type: '*int32'}
+    '''
+
+    with db.cursor() as c:
+        c.execute('DROP TABLE IF EXISTS "Data"')
+        c.execute('DROP TABLE IF EXISTS "Other"')
+
+    def tables():
+        with db.cursor() as c:
+            return sorted(r.table_name for r in c.tables() if r.table_name in ('Data', 'Other', 'List'))
+
+    c = Accum('odbc://;name=odbc;create-mode=checked;prepare=lazy;prepare-list=Data', scheme=scheme, dump='scheme', context=context, **odbcini)
+    c.open()
+
+    assert tables() == ['Data']
+
+    c.post({'f0': 10}, name='Other', seq=1)
+    assert tables() == ['Data', 'Other']
+    assert [tuple(r) for r in db.cursor().execute('SELECT * FROM "Other"')] == [(1, 10)]
+
+    with pytest.raises(TLLError): c.post({'f0': [10]}, name='List', seq=2)
+    with pytest.raises(TLLError): c.post({'f0': [10]}, name='List', seq=3)
+    assert caplog.text.count("Failed to prepare SQL statement for 'List'") == 1
+
+    c.close()
+    caplog.clear()
+
+    c = Accum('odbc://;name=odbc;create-mode=checked;prepare=lazy;strict=no', scheme=scheme, dump='scheme', context=context, **odbcini)
+    c.open()
+    c.post({'f0': [10]}, name='List', seq=4)
+    c.post({'f0': [10]}, name='List', seq=5)
+    assert caplog.text.count("Failed to prepare SQL statement for 'List'") == 1
+    c.post({'f0': 20}, name='Other', seq=6)
+    assert [tuple(r) for r in db.cursor().execute('SELECT * FROM "Other"')] == [(1, 10), (6, 20)]
+
+def test_catalog(context, db, odbcini):
+    scheme = '''yamls://
+    - name: Data
+      id: 10
+      fields:
+        - {name: f0, type: int32, options.sql.index: yes}
+        - {name: f1, type: string}
+    '''
+
+    def indexes():
+        with db.cursor() as c:
+            return sorted(r.index_name for r in c.statistics('Data') if r.index_name is not None)
+
+    with db.cursor() as c:
+        c.execute('DROP TABLE IF EXISTS "Data"')
+        c.execute('CREATE TABLE "Data" ("_tll_seq" INTEGER NOT NULL, "f0" INTEGER NOT NULL, "f1" VARCHAR NOT NULL)')
+
+    c = Accum('odbc://;name=odbc;create-mode=checked', scheme=scheme, dump='scheme', context=context, **odbcini)
+    c.open()
+
+    assert indexes() == ['_tll_Data__tll_seq', '_tll_Data_f0']
+    c.post({'f0': 10, 'f1': 'a'}, name='Data', seq=1)
+    c.close()
+
+    with db.cursor() as c:
+        c.execute('DROP TABLE IF EXISTS "Data"')
+        c.execute('CREATE TABLE "Data" ("_tll_seq" INTEGER NOT NULL, "f0" VARCHAR NOT NULL, "f1" VARCHAR NOT NULL)')
+
+    c = Accum('odbc://;name=odbc;create-mode=checked', scheme=scheme, dump='scheme', context=context, **odbcini)
+    with pytest.raises(TLLError): c.open()
+    c.close()
+
+    with db.cursor() as c:
+        c.execute('DROP TABLE IF EXISTS "Data"')
+        c.execute('CREATE TABLE "Data" ("_tll_seq" INTEGER NOT NULL, "f0" INTEGER NOT NULL)')
+
+    with pytest.raises(TLLError): c.open()
+
+def test_spill(context, db, odbcini, tmp_path):
+    with db.cursor() as c:
+        c.execute('DROP TABLE IF EXISTS "Data"')
+
+    def rows():
+        return [tuple(r) for r in db.cursor().execute('SELECT "_tll_seq", "f0" FROM "Data" ORDER BY "_tll_seq"')]
+
+    url = f'odbc://;name=odbc;create-mode=checked;spill={tmp_path / "spill.journal"};spill-latency=0ns'
+    c = Accum(url, scheme=SCHEME, dump='scheme', context=context, **odbcini)
+    c.open()
+
+    c.post({'f0': 0}, name='Data', seq=0)
+    assert rows() == [(0, 0)]
+    assert c.dcaps == 0
+
+    for i in range(1, 5):
+        c.post({'f0': i, 'f2': f'{i}' * i}, name='Data', seq=i)
+    c.post({'f0': 10}, name='Data', seq=2) # Duplicate seq is dropped on drain
+    assert rows() == [(0, 0)]
+    assert c.dcaps & c.DCaps.Process
+
+    c.close()
+    assert rows() == [(0, 0)]
+
+    c.open()
+    assert c.dcaps & c.DCaps.Process
+    c.process()
+    assert rows() == [(i, i) for i in range(5)]
+    assert c.dcaps == 0
+
+    c.post({'f0': 5}, name='Data', seq=5)
+    c.post({'message': 10}, name='Query', type=c.Type.Control)
+    assert rows() == [(i, i) for i in range(6)]
+
+@pytest.mark.parametrize("order", ["seq", "none"])
+def test_parallel(context, db, odbcini, caplog, order):
+    with db.cursor() as c:
+        c.execute('DROP TABLE IF EXISTS "Data"')
+
+    i = context.Channel('odbc://;name=insert;create-mode=checked', scheme=SCHEME, dir='w', **odbcini)
+    i.open()
+    for x in range(20):
+        i.post({'f0': x, 'f1': 10.5 * x, 'f2': str(x) * x}, name='Data', seq=100 + x)
+
+    c = Accum(f'odbc://;name=select;parallel=3;parallel-order={order};fetch-block=2', scheme=SCHEME, dump='scheme', context=context, **odbcini)
+    c.open()
+    c.post({'message': 10, 'expression': [{'field': 'f0', 'op': 'GE', 'value': {'i': 2}}]}, name='Query', type=c.Type.Control)
+
+    for _ in range(10000):
+        if c.result and c.result[-1].type == c.Type.Control:
+            break
+        c.process()
+
+    assert [(m.type, m.msgid) for m in c.result[-1:]] == [(c.Type.Control, 50)]
+    data = c.result[:-1]
+    if order == 'seq':
+        assert [m.seq for m in data] == list(range(102, 120))
+    else:
+        assert sorted([m.seq for m in data]) == list(range(102, 120))
+    for m in data:
+        x = m.seq - 100
+        assert c.unpack(m).as_dict() == {'f0': x, 'f1': 10.5 * x, 'f2': str(x) * x}
+    assert c.dcaps == 0
+
+    c.result = []
+    c.post({'message': 10, 'expression': [{'field': 'f0', 'op': 'GT', 'value': {'i': 100}}]}, name='Query', type=c.Type.Control)
+    assert [(m.type, m.msgid) for m in c.result] == [(c.Type.Control, 50)]
+
+    # Connections are taken from pool
+    connections = caplog.text.count("Connection string:")
+    c.result = []
+    c.post({'message': 10}, name='Query', type=c.Type.Control)
+    for _ in range(10000):
+        if c.result and c.result[-1].type == c.Type.Control:
+            break
+        c.process()
+    assert len(c.result) == 21
+    assert caplog.text.count("Connection string:") == connections
+
+    # Uncommitted rows are visible, query falls back to single cursor
+    c.result = []
+    c.post({}, name='Begin', type=c.Type.Control)
+    c.post({'f0': 50, 'f1': 0.0, 'f2': ''}, name='Data', seq=150)
+    c.post({'message': 10, 'expression': [{'field': 'f0', 'op': 'GE', 'value': {'i': 19}}]}, name='Query', type=c.Type.Control)
+    for _ in range(100):
+        if c.result and c.result[-1].type == c.Type.Control:
+            break
+        c.process()
+    assert [(m.type, m.seq) for m in c.result if m.type == c.Type.Data] == [(c.Type.Data, 119), (c.Type.Data, 150)]
+    c.post({}, name='Rollback', type=c.Type.Control)
+
+def test_prefetch(context, db, odbcini):
+    with db.cursor() as c:
+        c.execute('DROP TABLE IF EXISTS "Data"')
+
+    i = context.Channel('odbc://;name=insert;create-mode=checked', scheme=SCHEME, dir='w', **odbcini)
+    i.open()
+    for x in range(10):
+        i.post({'f0': x, 'f1': 10.5 * x, 'f2': str(x) * x}, name='Data', seq=x)
+
+    c = Accum('odbc://;name=select;prefetch=yes;prefetch-depth=1;fetch-block=3', scheme=SCHEME, dump='scheme', context=context, **odbcini)
+    c.open()
+    c.post({'message': 10}, name='Query', type=c.Type.Control)
+    with pytest.raises(TLLError): c.post({'message': 10}, name='Query', type=c.Type.Control)
+
+    for _ in range(10000):
+        if c.result and c.result[-1].type == c.Type.Control:
+            break
+        c.process()
+
+    assert [(m.type, m.msgid, m.seq) for m in c.result] == [(c.Type.Data, 10, x) for x in range(10)] + [(c.Type.Control, 50, 0)]
+    for m in c.result[:-1]:
+        assert c.unpack(m).as_dict() == {'f0': m.seq, 'f1': 10.5 * m.seq, 'f2': str(m.seq) * m.seq}
+    assert c.dcaps == 0
+
+    # Query in transaction sees its uncommitted rows
+    c.result = []
+    c.post({}, name='Begin', type=c.Type.Control)
+    c.post({'f0': 50, 'f1': 0.0, 'f2': ''}, name='Data', seq=50)
+    c.post({'message': 10, 'expression': [{'field': 'f0', 'op': 'GE', 'value': {'i': 9}}]}, name='Query', type=c.Type.Control)
+    for _ in range(100):
+        if c.result and c.result[-1].type == c.Type.Control:
+            break
+        c.process()
+    assert [(m.type, m.msgid, m.seq) for m in c.result] == [(c.Type.Data, 10, 9), (c.Type.Data, 10, 50), (c.Type.Control, 50, 0)]
+    c.post({}, name='Rollback', type=c.Type.Control)
+
+    c.result = []
+    c.post({'message': 10}, name='Query', type=c.Type.Control)
+    c.close()
+
+def test_slow_log(context, db, odbcini, caplog):
+    with db.cursor() as c:
+        c.execute('DROP TABLE IF EXISTS "Data"')
+
+    c = Accum('odbc://;name=odbc;create-mode=checked;slow-threshold=1ns;slow-interval=1h;slow-ring=2', scheme=SCHEME, dump='scheme', context=context, **odbcini)
+    c.open()
+
+    c.post({'f0': 1, 'f1': 1.5, 'f2': 'first'}, name='Data', seq=1)
+    assert "Slow insert of Data" in caplog.text
+    assert "f0=1, f1=1.5, f2='first'" in caplog.text
+
+    c.post({'f0': 2, 'f1': 2.5, 'f2': 'second'}, name='Data', seq=2)
+    c.post({'f0': 3, 'f1': 3.5, 'f2': 'third'}, name='Data', seq=3)
+    assert "f2='second'" not in caplog.text
+
+    c.post({}, name='SlowDump', type=c.Type.Control)
+    assert "Last 2 slow statements of 3 total" in caplog.text
+    assert "f2='second'" in caplog.text
+    assert "f2='third'" in caplog.text
+
+def test_session_profile(context, db, odbcini):
+    if db.getinfo(pyodbc.SQL_DBMS_NAME) != 'SQLite':
+        pytest.skip("Pragmas are checked only on SQLite")
+
+    with db.cursor() as c:
+        c.execute('DROP TABLE IF EXISTS "Data"')
+        c.execute('DROP TABLE IF EXISTS "Init"')
+
+    init = {'init-sql': 'CREATE TABLE IF NOT EXISTS `Init` (`a` INTEGER); INSERT INTO `Init` VALUES (10)'}
+    c = Accum('odbc://;name=odbc;create-mode=checked;quote-mode=sqlite;session-profile=fast', scheme=SCHEME, dump='scheme', context=context, **init, **odbcini)
+    c.open()
+
+    assert [tuple(r) for r in db.cursor().execute('PRAGMA journal_mode')] == [('wal',)]
+    assert [tuple(r) for r in db.cursor().execute('SELECT * FROM "Init"')] == [(10,)]
+
+    c.post({'f0': 1, 'f1': 1.5, 'f2': 'a'}, name='Data', seq=1)
+    assert [tuple(r) for r in db.cursor().execute('SELECT "_tll_seq" FROM "Data"')] == [(1,)]
+
+    c.close()
+
+    c = Accum('odbc://;name=odbc;init-sql.0=SELECT 1;init-sql.1=SELECT * FROM `NoSuchTable`', scheme=SCHEME, dump='scheme', context=context, **odbcini)
+    with pytest.raises(TLLError): c.open()
+
+    # List items are not split, semicolon in literal is kept
+    init = {'init-sql.0': "INSERT INTO `Init` VALUES (length('a;b'))"}
+    c = Accum('odbc://;name=odbc', scheme=SCHEME, dump='scheme', context=context, **init, **odbcini)
+    c.open()
+    assert [tuple(r) for r in db.cursor().execute('SELECT * FROM "Init"')] == [(10,), (3,)]
+
+def test_cache(context, db, odbcini):
+    scheme = '''yamls://
+    - name: Data
+      id: 10
+      options.sql.cache: yes
+      fields:
+        - {name: f0, type: int32}
+        - {name: f1, type: string}
+    '''
+
+    with db.cursor() as c:
+        c.execute('DROP TABLE IF EXISTS "Data"')
+
+    c = Accum('odbc://;name=odbc;create-mode=checked;cache-ttl=1h', scheme=scheme, dump='scheme', context=context, **odbcini)
+    c.open()
+    for x in range(3):
+        c.post({'f0': x, 'f1': str(x)}, name='Data', seq=x)
+
+    def query(value):
+        c.result = []
+        c.post({'message': 10, 'expression': [{'field': 'f0', 'op': 'GE', 'value': {'i': value}}]}, name='Query', type=c.Type.Control)
+        for _ in range(10):
+            c.process()
+        assert [(m.type, m.msgid) for m in c.result[-1:]] == [(c.Type.Control, 50)]
+        return [(m.seq, c.unpack(m).as_dict()) for m in c.result[:-1]]
+
+    assert query(1) == [(1, {'f0': 1, 'f1': '1'}), (2, {'f0': 2, 'f1': '2'})]
+
+    # Change table behind channel, cached result is returned
+    with db.cursor() as cur:
+        cur.execute('DELETE FROM "Data" WHERE "f0" = 2')
+    assert query(1) == [(1, {'f0': 1, 'f1': '1'}), (2, {'f0': 2, 'f1': '2'})]
+    assert query(2) == []
+
+    # Write through channel invalidates cache
+    c.post({'f0': 3, 'f1': '3'}, name='Data', seq=3)
+    assert query(1) == [(1, {'f0': 1, 'f1': '1'}), (3, {'f0': 3, 'f1': '3'})]
+    assert query(2) == [(3, {'f0': 3, 'f1': '3'})]
+
+def test_batch(context, db, odbcini):
+    scheme = '''yamls://
+    - name: Data
+      id: 10
+      fields:
+        - {name: f0, type: int32}
+        - {name: f1, type: double}
+        - {name: f2, type: string}
+    '''
+
+    with db.cursor() as c:
+        c.execute('DROP TABLE IF EXISTS "Data"')
+
+    c = Accum('odbc://;name=odbc;create-mode=checked;batch=2', scheme=scheme, dump='scheme', context=context, **odbcini)
+    c.open()
+    assert c.scheme.messages.DataBatch.msgid == 100010
+    for x in range(5):
+        c.post({'f0': x, 'f1': x / 10, 'f2': str(x) * x}, name='Data', seq=x)
+
+    c.post({'message': 10}, name='Query', type=c.Type.Control)
+    for _ in range(10):
+        c.process()
+
+    assert [(m.type, m.msgid, m.seq) for m in c.result] == [(c.Type.Data, 100010, 1), (c.Type.Data, 100010, 3), (c.Type.Data, 100010, 4), (c.Type.Control, 50, 0)]
+    result = [c.unpack(m) for m in c.result[:-1]]
+    assert [list(m._tll_seq) for m in result] == [[0, 1], [2, 3], [4]]
+    assert [list(m.f0) for m in result] == [[0, 1], [2, 3], [4]]
+    assert [list(m.f1) for m in result] == [[0, 0.1], [0.2, 0.3], [0.4]]
+    assert [list(m.f2) for m in result] == [['', '1'], ['22', '333'], ['4444']]
+
+def test_batch_options(context, db, odbcini):
+    scheme = '''yamls://
+    - name: Data
+      id: 10
+      fields:
+        - {name: pmap, type: uint8, options.pmap: yes}
+        - {name: f0, type: int32}
+        - {name: ts, type: int64, options.type: time_point, options.resolution: ms}
+        - {name: f1, type: byte8, options.type: string, options.optional: yes}
+    '''
+
+    with db.cursor() as c:
+        c.execute('DROP TABLE IF EXISTS "Data"')
+
+    c = Accum('odbc://;name=odbc;create-mode=checked;batch=4', scheme=scheme, dump='scheme', context=context, **odbcini)
+    c.open()
+    assert [f.name for f in c.scheme.messages.DataBatch.fields] == ['_tll_seq', 'f0', 'ts', 'f1']
+
+    ts = [TimePoint.from_str(f'2000-01-02T03:04:0{x}') for x in range(3)]
+    for x in range(3):
+        c.post({'f0': x, 'ts': ts[x], 'f1': str(x) * x}, name='Data', seq=x)
+
+    c.post({'message': 10}, name='Query', type=c.Type.Control)
+    for _ in range(10):
+        c.process()
+
+    assert [(m.type, m.msgid) for m in c.result] == [(c.Type.Data, 100010), (c.Type.Control, 50)]
+    m = c.unpack(c.result[0])
+    assert list(m.ts) == ts
+    assert list(m.f1) == ['', '1', '22']
+
+@pytest.mark.parametrize("t", ['"*Row"', 'Row[8]'])
+def test_rows(context, db, odbcini, t):
+    scheme = f'''yamls://
+    - name: Row
+      id: 10
+      options.sql.table: Data
+      fields:
+        - {{name: f0, type: int32}}
+        - {{name: f1, type: double}}
+        - {{name: f2, type: string}}
+    - name: Rows
+      id: 20
+      options.sql.rows: yes
+      fields:
+        - {{name: rows, type: {t}}}
+    '''
+
+    with db.cursor() as c:
+        c.execute('DROP TABLE IF EXISTS "Data"')
+
+    c = Accum('odbc://;name=odbc;create-mode=checked', scheme=scheme, dump='scheme', context=context, **odbcini)
+    c.open()
+    c.post({'rows': [{'f0': x, 'f1': x / 10, 'f2': str(x) * x} for x in range(5)]}, name='Rows', seq=100)
+    c.post({'rows': []}, name='Rows', seq=200)
+
+    assert [tuple(r) for r in db.cursor().execute('SELECT * FROM "Data" ORDER BY "_tll_seq"')] == [(100 + x, x, x / 10, str(x) * x) for x in range(5)]
+
+    # Seq values 101-104 are taken by rows of batch
+    with pytest.raises(TLLError):
+        c.post({'f0': 10, 'f1': 1.0, 'f2': ''}, name='Row', seq=101)
+    c.post({'f0': 10, 'f1': 1.0, 'f2': ''}, name='Row', seq=105)
+    c.post({'rows': [{'f0': x, 'f1': 0.0, 'f2': ''} for x in range(2)]}, name='Rows', seq=300) # Empty strings
+
+    assert [r[0] for r in db.cursor().execute('SELECT "_tll_seq" FROM "Data" ORDER BY "_tll_seq"')] == [100, 101, 102, 103, 104, 105, 300, 301]
+
+def test_commit_ack(context, db, odbcini):
+    with db.cursor() as c:
+        c.execute('DROP TABLE IF EXISTS "Data"')
+
+    c = Accum('odbc://;name=odbc;create-mode=checked;commit-ack=yes', scheme=SCHEME, dump='scheme', context=context, **odbcini)
+    c.open()
+
+    def acks():
+        r = [(m.msgid, c.unpack(m).seq) for m in c.result]
+        c.result = []
+        return r
+
+    c.post({'f0': 0}, name='Data', seq=10)
+    c.post({'f0': 1}, name='Data', seq=20)
+    assert acks() == [(100, 10), (100, 20)]
+
+    c.post({}, name='Begin', type=c.Type.Control)
+    c.post({'f0': 2}, name='Data', seq=30)
+    c.post({'f0': 3}, name='Data', seq=40)
+    assert acks() == []
+    c.post({}, name='Commit', type=c.Type.Control)
+    assert acks() == [(100, 40)]
+
+    c.post({}, name='Begin', type=c.Type.Control)
+    c.post({'f0': 4}, name='Data', seq=50)
+    c.post({}, name='Rollback', type=c.Type.Control)
+    assert acks() == []
+
+    with pytest.raises(TLLError):
+        c.post({}, name='Commit', type=c.Type.Control)
+
+    assert [r[0] for r in db.cursor().execute('SELECT "_tll_seq" FROM "Data" ORDER BY "_tll_seq"')] == [10, 20, 30, 40]
+
+def test_spill_rollback(context, db, odbcini, tmp_path):
+    with db.cursor() as c:
+        c.execute('DROP TABLE IF EXISTS "Data"')
+
+    url = f'odbc://;name=odbc;create-mode=checked;commit-ack=yes;spill={tmp_path / "spill.journal"};spill-latency=0ns'
+    c = Accum(url, scheme=SCHEME, dump='scheme', context=context, **odbcini)
+    c.open()
+
+    c.post({'f0': 0}, name='Data', seq=0)
+    c.post({'f0': 1}, name='Data', seq=1) # Spilled
+    c.post({}, name='Begin', type=c.Type.Control)
+    c.post({'f0': 2}, name='Data', seq=2)
+    c.post({}, name='Rollback', type=c.Type.Control)
+    assert c.dcaps == 0
+
+    c.post({}, name='Begin', type=c.Type.Control)
+    c.post({'f0': 3}, name='Data', seq=3)
+    c.post({}, name='Commit', type=c.Type.Control)
+
+    assert [c.unpack(m).seq for m in c.result] == [0, 1, 3]
+    assert [r[0] for r in db.cursor().execute('SELECT "_tll_seq" FROM "Data" ORDER BY "_tll_seq"')] == [0, 1, 3]
+
+@pytest.mark.parametrize("mode", ['count', 'age'])
+def test_retention(context, db, odbcini, mode):
+    if mode == 'count':
+        options = 'options.sql.retention: 3'
+    else:
+        options = 'options.sql.retention: 1h\n      options.sql.retention-field: ts'
+    scheme = f'''yamls://
+    - name: Data
+      id: 10
+      {options}
+      fields:
+        - {{name: f0, type: int32}}
+        - {{name: ts, type: int64, options.type: time_point, options.resolution: s}}
+    '''
+
+    with db.cursor() as c:
+        c.execute('DROP TABLE IF EXISTS "Data"')
+
+    c = Accum('odbc://;name=odbc;create-mode=checked;retention-chunk=2;retention-interval=1ms', scheme=scheme, dump='scheme', context=context, **odbcini)
+    c.open()
+    now = int(time.time())
+    for x in range(10):
+        c.post({'f0': x, 'ts': now - 3600 * (10 - x) + 1800}, name='Data', seq=x)
+
+    def rows():
+        return [r[0] for r in db.cursor().execute('SELECT "_tll_seq" FROM "Data" ORDER BY "_tll_seq"')]
+
+    time.sleep(0.002)
+    c.children[-1].process()
+    assert rows() == [2, 3, 4, 5, 6, 7, 8, 9]
+
+    for _ in range(5):
+        time.sleep(0.002)
+        c.children[-1].process()
+    assert rows() == ([7, 8, 9] if mode == 'count' else [9])
+
+def test_cancel(context, db, odbcini):
+    with db.cursor() as c:
+        c.execute('DROP TABLE IF EXISTS "Data"')
+
+    c = Accum('odbc://;name=odbc;create-mode=checked;query-timeout=10s', scheme=SCHEME, dump='scheme', context=context, **odbcini)
+    c.open()
+    for x in range(5):
+        c.post({'f0': x}, name='Data', seq=x)
+
+    c.post({}, name='Cancel', type=c.Type.Control) # No active query
+    c.post({'message': 10}, name='Query', type=c.Type.Control)
+    c.process()
+    c.process()
+    with pytest.raises(TLLError):
+        c.post({'f0': 10}, name='Data', seq=10)
+
+    c.post({}, name='Cancel', type=c.Type.Control)
+    assert [(m.type, m.msgid, m.seq) for m in c.result] == [(c.Type.Data, 10, 0), (c.Type.Data, 10, 1), (c.Type.Control, 50, 0)]
+    assert c.unpack(c.result[-1]).status.name == 'Cancel'
+    assert c.dcaps == 0
+
+    c.result = []
+    c.post({'message': 10}, name='Query', type=c.Type.Control)
+    for _ in range(10):
+        c.process()
+    assert [(m.type, m.msgid, m.seq) for m in c.result] == [(c.Type.Data, 10, x) for x in range(5)] + [(c.Type.Control, 50, 0)]
+    assert c.unpack(c.result[-1]).status.name == 'Ok'
+
+def test_query_timeout(context, db, odbcini):
+    if db.getinfo(pyodbc.SQL_DBMS_NAME) == 'SQLite':
+        pytest.skip("Table locks not supported in SQLite3")
+    with db.cursor() as c:
+        c.execute('DROP TABLE IF EXISTS "Data"')
+    db.commit()
+
+    c = Accum('odbc://;name=odbc;create-mode=checked;query-timeout=1s', scheme=SCHEME, dump='scheme', context=context, **odbcini)
+    c.open()
+    for x in range(5):
+        c.post({'f0': x}, name='Data', seq=x)
+
+    # Select is blocked by exclusive lock held in other transaction until timeout
+    with db.cursor() as cur:
+        cur.execute('LOCK TABLE "Data" IN ACCESS EXCLUSIVE MODE')
+    c.post({'message': 10}, name='Query', type=c.Type.Control)
+    db.rollback()
+
+    assert [(m.type, m.msgid) for m in c.result] == [(c.Type.Control, 50)]
+    assert c.unpack(c.result[-1]).status.name == 'Timeout'
+    assert c.dcaps == 0
+
+    c.result = []
+    c.post({'message': 10}, name='Query', type=c.Type.Control)
+    for _ in range(10):
+        c.process()
+    assert [(m.type, m.msgid, m.seq) for m in c.result] == [(c.Type.Data, 10, x) for x in range(5)] + [(c.Type.Control, 50, 0)]
+
+def test_shared_connection(context, db, odbcini, caplog):
+    with db.cursor() as c:
+        c.execute('DROP TABLE IF EXISTS "Data"')
+
+    c0 = Accum('odbc://;name=c0;create-mode=checked;shared-connection=yes', scheme=SCHEME, dump='scheme', context=context, **odbcini)
+    c1 = Accum('odbc://;name=c1;create-mode=checked;shared-connection=yes', scheme=SCHEME, dump='scheme', context=context, **odbcini)
+    c0.open()
+    c1.open()
+    assert "Use shared connection, 1 users" in caplog.text
+
+    c0.post({'f0': 0}, name='Data', seq=0)
+    c1.post({'f0': 1}, name='Data', seq=1)
+
+    with pytest.raises(TLLError):
+        c0.post({}, name='Begin', type=c0.Type.Control)
+
+    # Query result is spooled, cursor is closed and other channel can insert
+    c1.post({'message': 10}, name='Query', type=c1.Type.Control)
+    c0.post({'f0': 3}, name='Data', seq=3)
+    for _ in range(10):
+        if c1.dcaps == 0:
+            break
+        c1.process()
+    assert [(m.type, m.msgid, m.seq) for m in c1.result] == [(c1.Type.Data, 10, 0), (c1.Type.Data, 10, 1), (c1.Type.Control, 50, 0)]
+
+    c0.close()
+    assert "Close shared connection" not in caplog.text
+    c1.post({'f0': 2}, name='Data', seq=2)
+    c1.close()
+    assert "Close shared connection" in caplog.text
+
+    assert [r[0] for r in db.cursor().execute('SELECT "_tll_seq" FROM "Data" ORDER BY "_tll_seq"')] == [0, 1, 2, 3]
+
+def test_spool(context, db, odbcini, tmp_path):
+    with db.cursor() as c:
+        c.execute('DROP TABLE IF EXISTS "Data"')
+
+    spool = tmp_path / 'spool'
+    c = Accum(f'odbc://;name=odbc;create-mode=checked;spool=yes;spool-file={spool};spool-size=4kb', scheme=SCHEME, dump='scheme', context=context, **odbcini)
+    c.open()
+    for x in range(100):
+        c.post({'f0': x, 'f2': 'x' * x}, name='Data', seq=x)
+
+    c.post({'message': 10}, name='Query', type=c.Type.Control)
+    assert spool.stat().st_size > 4096
+
+    # Cursor is already closed, table can be modified while result is replayed
+    with db.cursor() as cur:
+        cur.execute('DELETE FROM "Data"')
+
+    for _ in range(200):
+        if c.dcaps == 0:
+            break
+        c.process()
+    assert [(m.type, m.msgid, m.seq) for m in c.result] == [(c.Type.Data, 10, x) for x in range(100)] + [(c.Type.Control, 50, 0)]
+    assert [c.unpack(m).f2 for m in c.result[:-1]] == ['x' * x for x in range(100)]
+
+def test_spool_requery(context, db, odbcini):
+    with db.cursor() as c:
+        c.execute('DROP TABLE IF EXISTS "Data"')
+
+    c = Accum('odbc://;name=odbc;create-mode=checked;spool=yes', scheme=SCHEME, dump='scheme', context=context, **odbcini)
+    c.open()
+    for x in range(5):
+        c.post({'f0': x}, name='Data', seq=x)
+
+    requery = []
+    def callback(channel, m):
+        if m.type == c.Type.Data and m.seq == 1 and not requery:
+            requery.append(m.seq)
+            c.post({}, name='Cancel', type=c.Type.Control)
+            c.post({'message': 10}, name='Query', type=c.Type.Control)
+    c.callback_add(callback)
+
+    c.post({'message': 10}, name='Query', type=c.Type.Control)
+    for _ in range(20):
+        if c.dcaps == 0:
+            break
+        c.process()
+
+    assert requery == [1]
+    assert [(m.type, m.msgid, m.seq) for m in c.result] == [(c.Type.Data, 10, 0), (c.Type.Data, 10, 1), (c.Type.Control, 50, 0)] + \
+        [(c.Type.Data, 10, x) for x in range(5)] + [(c.Type.Control, 50, 0)]
+
+def test_merge_query(context, db, odbcini):
+    scheme = '''yamls://
+- name: A
+  id: 10
+  fields:
+    - {name: a, type: int32}
+- name: B
+  id: 20
+  fields:
+    - {name: b, type: string}
+- name: C
+  id: 30
+  fields:
+    - {name: c, type: double}
+'''
+    with db.cursor() as c:
+        for t in 'ABC':
+            c.execute(f'DROP TABLE IF EXISTS "{t}"')
+
+    c = Accum('odbc://;name=odbc;create-mode=checked;fetch-block=2', scheme=scheme, dump='scheme', context=context, **odbcini)
+    c.open()
+
+    for seq in range(10):
+        if seq % 3:
+            c.post({'a': seq}, name='A', seq=seq)
+        else:
+            c.post({'b': f'b{seq}'}, name='B', seq=seq)
+
+    c.post({'messages': [10, 20, 30]}, name='MergeQuery', type=c.Type.Control)
+    for _ in range(20):
+        if c.dcaps == 0:
+            break
+        c.process()
+    assert [(m.type, m.msgid, m.seq) for m in c.result] == [(c.Type.Data, 20 if x % 3 == 0 else 10, x) for x in range(10)] + [(c.Type.Control, 50, 0)]
+    assert c.unpack(c.result[3]).b == 'b3'
+    assert c.unpack(c.result[4]).a == 4
+
+    c.result = []
+    c.post({'messages': [30]}, name='MergeQuery', type=c.Type.Control)
+    assert [(m.type, m.msgid) for m in c.result] == [(c.Type.Control, 50)]
+
+    c.post({}, name='Begin', type=c.Type.Control)
+    with pytest.raises(TLLError):
+        c.post({'messages': [10, 20]}, name='MergeQuery', type=c.Type.Control)
+    c.post({}, name='Rollback', type=c.Type.Control)